@@ -215,57 +215,71 @@ void _core_profiler_log(const char * event_name, char begin_or_end, const char *
 
 
 /**** ARENA ****/
+/*Every allocation is one malloc: this node followed by the memory, so the
+  node of a pointer is found without a search*/
 typedef struct core_Allocation {
     struct core_Allocation * next;
-    void * mem;
+    struct core_Allocation * prev; /*only kept for active allocations*/
     size_t len;
     core_Bool active;
 } core_Allocation;
 
 typedef struct {
-    core_Allocation * head;
+    core_Allocation * head; /*active allocations, most recent first*/
+    core_Allocation * free; /*reclaimed allocations waiting to be reused*/
 } core_Arena;
 
+#define CORE_ARENA_ALIGN 16
+#define CORE_ARENA_HEADER ((sizeof(core_Allocation) + CORE_ARENA_ALIGN - 1) / CORE_ARENA_ALIGN * CORE_ARENA_ALIGN)
+#define core_arena_mem(node) ((void *)((char *)(node) + CORE_ARENA_HEADER))
+#define core_arena_node(mem) ((core_Allocation *)((char *)(mem) - CORE_ARENA_HEADER))
+
 core_Allocation * core_arena_allocation_new(size_t bytes)
 #ifdef CORE_IMPLEMENTATION
 {
-    core_Allocation * ptr = malloc(sizeof(core_Allocation));
+    core_Allocation * ptr = malloc(CORE_ARENA_HEADER + bytes);
     assert(ptr);
-    ptr->mem = malloc(bytes);
-    assert(ptr->mem);
     ptr->len = bytes;
     ptr->active = CORE_TRUE;
     ptr->next = NULL;
+    ptr->prev = NULL;
     return ptr;
 }
 #else
 ;
 #endif /*CORE_IMPLEMENTATION*/
 
+void core_arena_link(core_Arena * a, core_Allocation * node)
+#ifdef CORE_IMPLEMENTATION
+{
+    node->active = CORE_TRUE;
+    node->prev = NULL;
+    node->next = a->head;
+    if(a->head) a->head->prev = node;
+    a->head = node;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
 CORE_NODISCARD
 void * core_arena_alloc(core_Arena * a, const size_t bytes)
 #ifdef CORE_IMPLEMENTATION
 {
+    core_Allocation ** link = NULL;
     core_Allocation * ptr = NULL;
-    if(a->head == NULL) {
-        core_Allocation * head = core_arena_allocation_new(bytes);
-        a->head = head;
-        return a->head->mem;
-    }
-   ptr = a->head;
-    for(;ptr->next != NULL; ptr = ptr->next) {
-        if(!ptr->active && ptr->len >= bytes) {
-            ptr->active = CORE_TRUE;
-            return ptr->mem;
+    /*only reclaimed allocations are searched, so the common case is constant time*/
+    for(link = &a->free; *link != NULL; link = &(*link)->next) {
+        if((*link)->len >= bytes) {
+            ptr = *link;
+            *link = ptr->next;
+            core_arena_link(a, ptr);
+            return core_arena_mem(ptr);
         }
     }
-    assert(ptr != NULL);
-    assert(ptr->next == NULL);
-    {
-        core_Allocation * next =  core_arena_allocation_new(bytes);
-        ptr->next = next;
-        return next->mem;
-    }
+    ptr = core_arena_allocation_new(bytes);
+    core_arena_link(a, ptr);
+    return core_arena_mem(ptr);
 }
 #else
 ;
@@ -276,10 +290,15 @@ void core_arena_reclaim_memory(core_Arena * a, void * ptr) /*Equivalent to free(
 {
     core_Allocation * node = NULL;
     assert(ptr != NULL);
-    for(node = a->head; node != NULL && node->mem != ptr; node = node->next);
-    assert(node != NULL);
-    assert(node->mem == ptr);
+    node = core_arena_node(ptr);
+    assert(node->active);
+    if(node->prev) node->prev->next = node->next;
+    else a->head = node->next;
+    if(node->next) node->next->prev = node->prev;
     node->active = CORE_FALSE;
+    node->prev = NULL;
+    node->next = a->free;
+    a->free = node;
 }
 #else
 ;
@@ -290,36 +309,27 @@ void * core_arena_realloc(core_Arena * a, void * ptr, const size_t bytes)
 #ifdef CORE_IMPLEMENTATION
 {
     core_Allocation * node = NULL;
-    core_Allocation * new = NULL;
+    void * mem = NULL;
     assert(ptr != NULL);
-    for(node = a->head; node != NULL && node->mem != ptr; node = node->next);
-    assert(node != NULL);
-    assert(node->mem == ptr);
-    assert(bytes >= node->len);
-    node->active = CORE_FALSE;
-    new = core_arena_allocation_new(bytes);
-    assert(new);
-    assert(new->len >= node->len);
-    memcpy(new->mem, node->mem, node->len);
-    new->next = a->head;
-    a->head = new;
-    return new->mem;
+    node = core_arena_node(ptr);
+    assert(node->active);
+    if(bytes <= node->len) return ptr; /*recycled allocations can already be large enough*/
+    mem = core_arena_alloc(a, bytes);
+    memcpy(mem, ptr, node->len);
+    core_arena_reclaim_memory(a, ptr);
+    return mem;
 }
 #else
 ;
 #endif /*CORE_IMPLEMENTATION*/
     
     
-void core_arena_free(core_Arena * a)
+void core_arena_free_list(core_Allocation * ptr)
 #ifdef CORE_IMPLEMENTATION
 {
-    core_Allocation * ptr = NULL;
-    if(a->head == NULL) return;
-    for(ptr = a->head;;) {
+    while(ptr != NULL) {
         core_Allocation * next = ptr->next;
-        free(ptr->mem);
         free(ptr);
-        if(next == NULL) return;
         ptr = next;
     }
 }
@@ -327,6 +337,18 @@ void core_arena_free(core_Arena * a)
 ;
 #endif /*CORE_IMPLEMENTATION*/
 
+void core_arena_free(core_Arena * a)
+#ifdef CORE_IMPLEMENTATION
+{
+    core_arena_free_list(a->head);
+    core_arena_free_list(a->free);
+    a->head = NULL;
+    a->free = NULL;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
 char * core_arena_strdup(core_Arena * arena, const char * str)
 #ifdef CORE_IMPLEMENTATION
 {
@@ -343,6 +365,20 @@ char * core_arena_strdup(core_Arena * arena, const char * str)
 /**** SLICE ****/
 #define core_Slice(Type) struct {Type * ptr; unsigned int len;}
 
+#define core_slice_streql(slice, str) (strlen(str) == (slice).len && memcmp((slice).ptr, str, (slice).len) == 0)
+
+char * core_arena_strndup(core_Arena * arena, const char * str, size_t len)
+#ifdef CORE_IMPLEMENTATION
+{
+    char * mem = core_arena_alloc(arena, len + 1);
+    memcpy(mem, str, len);
+    mem[len] = 0;
+    return mem;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
 
 /**** VEC ****/
 #define core_Vec(Type) struct {Type * items; unsigned int len; unsigned int cap; }
@@ -368,10 +404,340 @@ char * core_arena_strdup(core_Arena * arena, const char * str)
 
 
 /**** CTYPE ****/
+/*Locale independent ASCII classification, one table load per query*/
+#define CORE_CTYPE_SPACE       0x01
+#define CORE_CTYPE_IDENT_START 0x02
+#define CORE_CTYPE_IDENT       0x04 /*identifier continue*/
+#define CORE_CTYPE_DIGIT       0x08
+#define CORE_CTYPE_PUNCT       0x10
+
+extern const unsigned char core_ctype_table[256];
+
+#ifdef CORE_IMPLEMENTATION
+#define _CORE_S CORE_CTYPE_SPACE
+#define _CORE_I (CORE_CTYPE_IDENT_START | CORE_CTYPE_IDENT)
+#define _CORE_D (CORE_CTYPE_IDENT | CORE_CTYPE_DIGIT)
+#define _CORE_P CORE_CTYPE_PUNCT
+const unsigned char core_ctype_table[256] = {
+          0,       0,       0,       0,       0,       0,       0,       0,       0, _CORE_S, _CORE_S, _CORE_S, _CORE_S, _CORE_S,       0,       0, /*00*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*10*/
+    _CORE_S, _CORE_P,       0, _CORE_P,       0, _CORE_P, _CORE_P,       0, _CORE_P, _CORE_P, _CORE_P, _CORE_P, _CORE_P, _CORE_P, _CORE_P, _CORE_P, /*20*/
+    _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_D, _CORE_P, _CORE_P, _CORE_P, _CORE_P, _CORE_P, _CORE_P, /*30*/
+          0, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, /*40*/
+    _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_P,       0, _CORE_P, _CORE_P, _CORE_I, /*50*/
+          0, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, /*60*/
+    _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_I, _CORE_P, _CORE_P, _CORE_P, _CORE_P,       0, /*70*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*80*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*90*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*A0*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*B0*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*C0*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*D0*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0, /*E0*/
+          0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0 /*F0*/
+};
+#undef _CORE_S
+#undef _CORE_I
+#undef _CORE_D
+#undef _CORE_P
+#endif /*CORE_IMPLEMENTATION*/
+
+#define CORE_CTYPE_IS(ch, flags) (core_ctype_table[(unsigned char)(ch)] & (flags))
+
 core_Bool core_isidentifier(char ch)
 #ifdef CORE_IMPLEMENTATION
 {
-    return isalpha(ch) || isdigit(ch) || ch == '_';
+    return CORE_CTYPE_IS(ch, CORE_CTYPE_IDENT) != 0;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+/**** SCAN ****/
+/*Bulk scanners over [p, end) used by the lexer. Each returns the first byte
+  that stops the run, or end. The SIMD kernels are picked at runtime from the
+  CPU features, CORE_NO_SIMD forces the scalar ones.*/
+#if !defined(CORE_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#   define CORE_SIMD_X86
+#   include <immintrin.h>
+#endif /*CORE_SIMD_X86*/
+
+typedef enum {
+    CORE_SCAN_SCALAR,
+    CORE_SCAN_SSE2,
+    CORE_SCAN_AVX2
+} core_ScanKernel;
+
+typedef struct {
+    const char * (*whitespace)(const char * p, const char * end);
+    const char * (*identifier)(const char * p, const char * end);
+    unsigned long (*newlines)(const char * p, const char * end);
+} core_ScanFns;
+
+#ifdef CORE_IMPLEMENTATION
+static const char * _core_scan_whitespace_scalar(const char * p, const char * end) {
+    while(p < end && CORE_CTYPE_IS(*p, CORE_CTYPE_SPACE)) ++p;
+    return p;
+}
+
+static const char * _core_scan_identifier_scalar(const char * p, const char * end) {
+    while(p < end && CORE_CTYPE_IS(*p, CORE_CTYPE_IDENT)) ++p;
+    return p;
+}
+
+static unsigned long _core_count_newlines_scalar(const char * p, const char * end) {
+    unsigned long n = 0;
+    for(; p < end; ++p) n += (*p == '\n');
+    return n;
+}
+
+#ifdef CORE_SIMD_X86
+/*unsigned lo <= v <= hi, bytewise*/
+#define _CORE_SSE2_IN_RANGE(v, lo, hi) \
+    _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), _mm_set1_epi8((char)((hi) - (lo)))), _mm_sub_epi8(v, _mm_set1_epi8(lo)))
+#define _CORE_AVX2_IN_RANGE(v, lo, hi) \
+    _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(lo)), _mm256_set1_epi8((char)((hi) - (lo)))), _mm256_sub_epi8(v, _mm256_set1_epi8(lo)))
+
+__attribute__((target("sse2")))
+static const char * _core_scan_whitespace_sse2(const char * p, const char * end) {
+    while(end - p >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)p);
+        const __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _CORE_SSE2_IN_RANGE(v, '\t', '\r'));
+        const unsigned int mask = (unsigned int)_mm_movemask_epi8(ws) ^ 0xFFFFu;
+        if(mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return _core_scan_whitespace_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char * _core_scan_identifier_sse2(const char * p, const char * end) {
+    while(end - p >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)p);
+        const __m128i alpha = _CORE_SSE2_IN_RANGE(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        const __m128i digit = _CORE_SSE2_IN_RANGE(v, '0', '9');
+        const __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        const unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under)) ^ 0xFFFFu;
+        if(mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return _core_scan_identifier_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static unsigned long _core_count_newlines_sse2(const char * p, const char * end) {
+    unsigned long n = 0;
+    while(end - p >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)p);
+        n += (unsigned long)__builtin_popcount((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+        p += 16;
+    }
+    return n + _core_count_newlines_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char * _core_scan_whitespace_avx2(const char * p, const char * end) {
+    while(end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        const __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _CORE_AVX2_IN_RANGE(v, '\t', '\r'));
+        const unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(ws);
+        if(mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return _core_scan_whitespace_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char * _core_scan_identifier_avx2(const char * p, const char * end) {
+    while(end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        const __m256i alpha = _CORE_AVX2_IN_RANGE(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        const __m256i digit = _CORE_AVX2_IN_RANGE(v, '0', '9');
+        const __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+        const unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), under));
+        if(mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return _core_scan_identifier_sse2(p, end);
+}
+
+__attribute__((target("avx2,popcnt")))
+static unsigned long _core_count_newlines_avx2(const char * p, const char * end) {
+    unsigned long n = 0;
+    while(end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        n += (unsigned long)__builtin_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+        p += 32;
+    }
+    return n + _core_count_newlines_sse2(p, end);
+}
+#endif /*CORE_SIMD_X86*/
+
+static const core_ScanFns _core_scan_kernels[] = {
+    {_core_scan_whitespace_scalar, _core_scan_identifier_scalar, _core_count_newlines_scalar},
+#ifdef CORE_SIMD_X86
+    {_core_scan_whitespace_sse2, _core_scan_identifier_sse2, _core_count_newlines_sse2},
+    {_core_scan_whitespace_avx2, _core_scan_identifier_avx2, _core_count_newlines_avx2},
+#endif /*CORE_SIMD_X86*/
+};
+
+static const core_ScanFns * _core_scan = NULL;
+#endif /*CORE_IMPLEMENTATION*/
+
+/*Best kernel this CPU supports*/
+core_ScanKernel core_scan_detect(void)
+#ifdef CORE_IMPLEMENTATION
+{
+#ifdef CORE_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) return CORE_SCAN_AVX2;
+    if(__builtin_cpu_supports("sse2")) return CORE_SCAN_SSE2;
+#endif /*CORE_SIMD_X86*/
+    return CORE_SCAN_SCALAR;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+/*Selects the scanning kernel, clamped to what the CPU supports. Returns the kernel in use*/
+core_ScanKernel core_scan_use(core_ScanKernel kernel)
+#ifdef CORE_IMPLEMENTATION
+{
+    const core_ScanKernel best = core_scan_detect();
+    if(kernel > best) kernel = best;
+    assert((unsigned long)kernel < CORE_ARRAY_LEN(_core_scan_kernels));
+    _core_scan = &_core_scan_kernels[kernel];
+    return kernel;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+const core_ScanFns * core_scan_fns(void)
+#ifdef CORE_IMPLEMENTATION
+{
+    if(_core_scan == NULL) (void)core_scan_use(CORE_SCAN_AVX2);
+    return _core_scan;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+#define core_scan_whitespace(p, end) (core_scan_fns()->whitespace(p, end))
+#define core_scan_identifier(p, end) (core_scan_fns()->identifier(p, end))
+#define core_count_newlines(p, end) (core_scan_fns()->newlines(p, end))
+
+/**** SWAR ****/
+/*Digit runs scanned and converted eight bytes at a time inside an unsigned
+  long. Needs a little endian target with 64 bit longs, others take the
+  byte at a time path*/
+#if !defined(CORE_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && ULONG_MAX > 0xFFFFFFFFUL \
+    && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#   define CORE_SWAR
+#endif /*CORE_SWAR*/
+
+typedef enum {
+    CORE_PARSE_OK,
+    CORE_PARSE_INVALID_DIGIT,
+    CORE_PARSE_OVERFLOW
+} core_ParseResult;
+
+#ifdef CORE_SWAR
+#define _CORE_SWAR_ONES (~0UL / 255)
+#define _CORE_SWAR_HIGHS (_CORE_SWAR_ONES * 128)
+/*high bit set in every byte b with lo <= b <= hi, for ASCII bytes only*/
+#define _CORE_SWAR_BETWEEN(x, lo, hi) \
+    ((_CORE_SWAR_ONES * (127 + (hi) + 1) - ((x) & _CORE_SWAR_ONES * 127)) & ~(x) & \
+     (((x) & _CORE_SWAR_ONES * 127) + _CORE_SWAR_ONES * (127 - ((lo) - 1))) & _CORE_SWAR_HIGHS)
+
+#ifdef CORE_IMPLEMENTATION
+static unsigned long _core_swar_load(const char * p) {
+    unsigned long x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/*high bit set in every byte that is a digit of base 8, 10 or 16*/
+static unsigned long _core_swar_digit_mask(unsigned long x, unsigned int base) {
+    if(base == 16) {
+        return _CORE_SWAR_BETWEEN(x, '0', '9') | _CORE_SWAR_BETWEEN(x | _CORE_SWAR_ONES * 0x20, 'a', 'f');
+    }
+    return base == 8 ? _CORE_SWAR_BETWEEN(x, '0', '7') : _CORE_SWAR_BETWEEN(x, '0', '9');
+}
+#endif /*CORE_IMPLEMENTATION*/
+#endif /*CORE_SWAR*/
+
+/*Returns the first byte in [p, end) that is not a digit of base 8, 10 or 16*/
+const char * core_scan_digits(const char * p, const char * end, unsigned int base)
+#ifdef CORE_IMPLEMENTATION
+{
+#ifdef CORE_SWAR
+    while(end - p >= (long)sizeof(unsigned long)) {
+        const unsigned long miss = ~_core_swar_digit_mask(_core_swar_load(p), base) & _CORE_SWAR_HIGHS;
+        if(miss) return p + __builtin_ctzl(miss) / CHAR_BIT;
+        p += sizeof(unsigned long);
+    }
+#endif /*CORE_SWAR*/
+    for(; p < end; ++p) {
+        const unsigned char c = (unsigned char)*p;
+        unsigned int digit;
+        if(CORE_CTYPE_IS(c, CORE_CTYPE_DIGIT)) digit = c - '0';
+        else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') digit = (c | 0x20) - 'a' + 10;
+        else break;
+        if(digit >= base) break;
+    }
+    return p;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+/*Converts `len` digits of base 8, 10 or 16 into *out, without prefix or suffix*/
+core_ParseResult core_parse_digits(const char * p, unsigned long len, unsigned int base, unsigned long * out)
+#ifdef CORE_IMPLEMENTATION
+{
+    const char * end = p + len;
+    unsigned long value = 0;
+    assert(base == 8 || base == 10 || base == 16);
+    if(core_scan_digits(p, end, base) != end) return CORE_PARSE_INVALID_DIGIT;
+#ifdef CORE_SWAR
+    while(end - p >= 8) {
+        unsigned long x = _core_swar_load(p);
+        unsigned long chunk;
+        if(base == 10) {
+            /*combine neighbouring lanes: 8 x 1 digit -> 4 x 2 -> 2 x 4 -> 1 x 8*/
+            x -= _CORE_SWAR_ONES * '0';
+            x = (x * 10 + (x >> 8)) & 0x00FF00FF00FF00FFUL;
+            x = (x * 100 + (x >> 16)) & 0x0000FFFF0000FFFFUL;
+            chunk = (x * 10000 + (x >> 32)) & 0xFFFFFFFFUL;
+            if(value > (ULONG_MAX - chunk) / 100000000UL) return CORE_PARSE_OVERFLOW;
+            value = value * 100000000UL + chunk;
+        } else if(base == 16) {
+            x = (x & _CORE_SWAR_ONES * 0x0F) + 9 * ((x >> 6) & _CORE_SWAR_ONES);
+            x = ((x << 4) | (x >> 8)) & 0x00FF00FF00FF00FFUL;
+            x = ((x << 8) | (x >> 16)) & 0x0000FFFF0000FFFFUL;
+            chunk = ((x << 16) | (x >> 32)) & 0xFFFFFFFFUL;
+            if(value >> (sizeof(value) * CHAR_BIT - 32)) return CORE_PARSE_OVERFLOW;
+            value = (value << 16 << 16) | chunk;
+        } else {
+            x -= _CORE_SWAR_ONES * '0';
+            x = ((x << 3) | (x >> 8)) & 0x00FF00FF00FF00FFUL;
+            x = ((x << 6) | (x >> 16)) & 0x0000FFFF0000FFFFUL;
+            chunk = ((x << 12) | (x >> 32)) & 0xFFFFFFUL;
+            if(value >> (sizeof(value) * CHAR_BIT - 24)) return CORE_PARSE_OVERFLOW;
+            value = (value << 24) | chunk;
+        }
+        p += 8;
+    }
+#endif /*CORE_SWAR*/
+    for(; p < end; ++p) {
+        const unsigned char c = (unsigned char)*p;
+        const unsigned int digit = CORE_CTYPE_IS(c, CORE_CTYPE_DIGIT) ? c - '0' : (c | 0x20) - 'a' + 10;
+        if(value > (ULONG_MAX - digit) / base) return CORE_PARSE_OVERFLOW;
+        value = value * base + digit;
+    }
+    *out = value;
+    return CORE_PARSE_OK;
 }
 #else
 ;
@@ -433,7 +799,7 @@ char core_peek(FILE * fp)
 void core_skip_whitespace(FILE * fp)
 #ifdef CORE_IMPLEMENTATION
 {
-    while(isspace(core_peek(fp))) (void)fgetc(fp);
+    while(CORE_CTYPE_IS(core_peek(fp), CORE_CTYPE_SPACE)) (void)fgetc(fp);
 }
 #else
 ;
@@ -454,25 +820,42 @@ void core_skip_whitespace(FILE * fp)
 /* ; */
 /* #endif /\*CORE_IMPLEMENTATION*\/ */
 
-char * core_file_read_all_arena(core_Arena * arena, const char * filepath)
+/*Reads the whole file into a NUL terminated arena buffer, storing its length in *len if len is not NULL*/
+char * core_file_read_all_arena_len(core_Arena * arena, const char * filepath, size_t * len)
 #ifdef CORE_IMPLEMENTATION
 {
     FILE * fp = fopen(filepath, "rb");
     char * buf;
-    size_t filelen;
+    long filelen;
+    size_t count;
     if(!fp) return NULL;
     fseek(fp, 0, SEEK_END);
-    filelen = (size_t)ftell(fp);
-    buf = core_arena_alloc(arena, filelen + 1);
-    fread(buf, 1, filelen, fp);
-    buf[filelen] = 0;
+    filelen = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(filelen < 0) {
+        fclose(fp);
+        return NULL;
+    }
+    buf = core_arena_alloc(arena, (size_t)filelen + 1);
+    count = fread(buf, 1, (size_t)filelen, fp);
+    buf[count] = 0;
     fclose(fp);
+    if(len) *len = count;
     return buf;
 }
 #else
 ;
 #endif /* CORE_IMPLEMENTATION */
 
+char * core_file_read_all_arena(core_Arena * arena, const char * filepath)
+#ifdef CORE_IMPLEMENTATION
+{
+    return core_file_read_all_arena_len(arena, filepath, NULL);
+}
+#else
+;
+#endif /* CORE_IMPLEMENTATION */
+
 
 /*TODO
   
@@ -688,6 +1071,26 @@ unsigned long core_hash(const char * key, unsigned long modulus)
 ;
 #endif /*CORE_IMPLEMENTATION*/
 
+/*core_hash over the first len bytes of key, which need not be NUL terminated*/
+unsigned long core_hash_n(const char * key, unsigned long len, unsigned long modulus)
+#ifdef CORE_IMPLEMENTATION
+{
+    unsigned long hash = 5381;
+    unsigned long i = 0;
+
+    assert(modulus > 0);
+
+    for(i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)key[i];
+        hash = ((hash << 5) + hash) + c;
+    }
+    
+    return (hash % modulus);
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
 
 
 /**** STAT ****/
@@ -774,6 +1177,16 @@ void core_gensym(char * dst, size_t n)
 
 
 /**** HASHMAP V2 ****/
+#ifndef CORE_HASHMAP_INITIAL_BUCKETS
+#   define CORE_HASHMAP_INITIAL_BUCKETS 16
+#endif /*CORE_HASHMAP_INITIAL_BUCKETS*/
+#ifndef CORE_HASHMAP_MAX_LOAD_FACTOR
+#   define CORE_HASHMAP_MAX_LOAD_FACTOR 3 /*keys per bucket before rehashing*/
+#endif /*CORE_HASHMAP_MAX_LOAD_FACTOR*/
+#ifndef CORE_HASHMAP_GROWTH_FACTOR
+#   define CORE_HASHMAP_GROWTH_FACTOR 4 /*buckets per key after rehashing*/
+#endif /*CORE_HASHMAP_GROWTH_FACTOR*/
+
 typedef struct core_HashmapNode {
     struct core_HashmapNode * next;
     unsigned long index;
@@ -782,10 +1195,31 @@ typedef struct core_HashmapNode {
 typedef core_Vec(core_HashmapNode*) core_HashmapBuckets;
 typedef core_Vec(const char *) core_HashmapKeys;
 
-core_Bool core_hashmap_get_index(core_HashmapBuckets * buckets, core_HashmapKeys * keys, unsigned long * result, const char * key)
+/*Running counters updated by the hashmap functions, may be NULL*/
+typedef struct {
+    unsigned long lookups;
+    unsigned long probes; /*nodes visited across all lookups*/
+    unsigned long rehashes;
+    clock_t rehash_clocks;
+} core_HashmapCounters;
+
+/*Snapshot computed by core_hashmap_stats*/
+typedef struct {
+    unsigned long key_count;
+    unsigned long bucket_count;
+    unsigned long empty_buckets;
+    unsigned long longest_chain;
+    double load_factor;
+    double average_probe_length;
+    unsigned long rehash_count;
+    double rehash_seconds;
+} core_HashmapStats;
+
+core_Bool core_hashmap_get_index(core_HashmapBuckets * buckets, core_HashmapKeys * keys, core_HashmapCounters * counters, unsigned long * result, const char * key)
 #ifdef CORE_IMPLEMENTATION
 {
     unsigned long i;
+    unsigned long probes = 0;
     core_HashmapNode * node;
 
     if(buckets->len <= 0) return CORE_FALSE;
@@ -793,14 +1227,51 @@ core_Bool core_hashmap_get_index(core_HashmapBuckets * buckets, core_HashmapKeys
     i = core_hash(key, buckets->len);
     assert(i < buckets->len);
     node = buckets->items[i];
+    if(counters) ++counters->lookups;
     while(node) {
         assert(node->index < keys->len);
+        ++probes;
         if(core_streql(keys->items[node->index], key)) {
+            if(counters) counters->probes += probes;
             *result = node->index;
             return CORE_TRUE;
         }
         node = node->next;
     } 
+    if(counters) counters->probes += probes;
+    *result = (unsigned long)-1;
+    return CORE_FALSE;
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+/*Looks up a key given as a slice, so callers do not need a NUL terminated copy*/
+core_Bool core_hashmap_get_index_n(core_HashmapBuckets * buckets, core_HashmapKeys * keys, core_HashmapCounters * counters, unsigned long * result, const char * key, unsigned long len)
+#ifdef CORE_IMPLEMENTATION
+{
+    unsigned long i;
+    unsigned long probes = 0;
+    core_HashmapNode * node;
+
+    if(buckets->len <= 0) return CORE_FALSE;
+
+    i = core_hash_n(key, len, buckets->len);
+    assert(i < buckets->len);
+    node = buckets->items[i];
+    if(counters) ++counters->lookups;
+    while(node) {
+        const char * candidate = keys->items[node->index];
+        assert(node->index < keys->len);
+        ++probes;
+        if(strncmp(candidate, key, len) == 0 && candidate[len] == 0) {
+            if(counters) counters->probes += probes;
+            *result = node->index;
+            return CORE_TRUE;
+        }
+        node = node->next;
+    } 
+    if(counters) counters->probes += probes;
     *result = (unsigned long)-1;
     return CORE_FALSE;
 }
@@ -811,26 +1282,26 @@ core_Bool core_hashmap_get_index(core_HashmapBuckets * buckets, core_HashmapKeys
 core_Bool core_hashmap_needs_resize(unsigned long num_keys, unsigned long num_buckets) 
 #ifdef CORE_IMPLEMENTATION
 {
-    return num_keys >= num_buckets * 3;
+    return num_keys >= num_buckets * CORE_HASHMAP_MAX_LOAD_FACTOR;
 }
 #else
 ;
 #endif /*CORE_IMPLEMENTATION*/
 
-void core_hashmap_rehash(core_HashmapBuckets * buckets, core_Arena * arena, core_HashmapKeys * keys);
+void core_hashmap_rehash(core_HashmapBuckets * buckets, core_Arena * arena, core_HashmapKeys * keys, core_HashmapCounters * counters);
 
-void core_hashmap_record_new_key(core_HashmapBuckets * buckets, core_Arena * arena, core_HashmapKeys * keys, const char * key, unsigned long index)
+void core_hashmap_record_new_key(core_HashmapBuckets * buckets, core_Arena * arena, core_HashmapKeys * keys, core_HashmapCounters * counters, const char * key, unsigned long index)
 #ifdef CORE_IMPLEMENTATION
 {
     unsigned long i;
     core_HashmapNode * new;
 
     if(buckets->cap == 0) {
-        for(i = 0; i < 16; ++i) {
+        for(i = 0; i < CORE_HASHMAP_INITIAL_BUCKETS; ++i) {
             core_vec_append(buckets, arena, NULL);
         }
     } else if(core_hashmap_needs_resize(index, buckets->len)) {
-        core_hashmap_rehash(buckets, arena, keys);
+        core_hashmap_rehash(buckets, arena, keys, counters);
     }
 
     i = core_hash(key, buckets->len);
@@ -850,20 +1321,21 @@ void core_hashmap_record_new_key(core_HashmapBuckets * buckets, core_Arena * are
 ;
 #endif /*CORE_IMPLEMENTATION*/
 
-void core_hashmap_rehash(core_HashmapBuckets * buckets, core_Arena * arena, core_HashmapKeys * keys)
+void core_hashmap_rehash(core_HashmapBuckets * buckets, core_Arena * arena, core_HashmapKeys * keys, core_HashmapCounters * counters)
 #ifdef CORE_IMPLEMENTATION
 {
     core_HashmapBuckets new = {0};
     unsigned long i;
+    clock_t start = clock();
 
     /*initialize new resized buckets array*/
-    for(i = 0; i < keys->len * 4; ++i) {
+    for(i = 0; i < keys->len * CORE_HASHMAP_GROWTH_FACTOR; ++i) {
         core_vec_append(&new, arena, NULL);
     }
     
     /*copy keys into new buckets*/
     for(i = 0; i < keys->len; ++i) {
-        core_hashmap_record_new_key(&new, arena, keys, keys->items[i], i);
+        core_hashmap_record_new_key(&new, arena, keys, NULL, keys->items[i], i);
     }
 
     /*free old buckets memory*/
@@ -879,26 +1351,115 @@ void core_hashmap_rehash(core_HashmapBuckets * buckets, core_Arena * arena, core
     
     /*update buckets reference to use the newly resized array*/
     *buckets = new;
+
+    if(counters) {
+        ++counters->rehashes;
+        counters->rehash_clocks += clock() - start;
+    }
 }
 #else
 ;
 #endif /*CORE_IMPLEMENTATION*/
 
-#define core_Hashmap(T) struct { core_Vec(T) values; core_HashmapKeys keys; core_HashmapBuckets buckets; unsigned long index; }
+void core_hashmap_compute_stats(const core_HashmapBuckets * buckets, const core_HashmapKeys * keys, const core_HashmapCounters * counters, core_HashmapStats * out)
+#ifdef CORE_IMPLEMENTATION
+{
+    unsigned long i;
+    memset(out, 0, sizeof(*out));
+    out->key_count = keys->len;
+    out->bucket_count = buckets->len;
+    for(i = 0; i < buckets->len; ++i) {
+        unsigned long chain = 0;
+        core_HashmapNode * node = buckets->items[i];
+        for(; node; node = node->next) ++chain;
+        if(chain == 0) ++out->empty_buckets;
+        out->longest_chain = CORE_MAX(out->longest_chain, chain);
+    }
+    if(buckets->len > 0) out->load_factor = (double)keys->len / (double)buckets->len;
+    if(counters) {
+        if(counters->lookups > 0) out->average_probe_length = (double)counters->probes / (double)counters->lookups;
+        out->rehash_count = counters->rehashes;
+        out->rehash_seconds = (double)counters->rehash_clocks / CLOCKS_PER_SEC;
+    }
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
 
-#define core_hashmap_get(self, key)                                                        \
-    (                                                                                        \
-        core_hashmap_get_index(&(self)->buckets, &(self)->keys, &(self)->index, key)       \
-        ? (&(self)->values.items[(self)->index]) : NULL                                      \
+void core_hashmap_fprint_stats(FILE * fp, const core_HashmapStats * stats)
+#ifdef CORE_IMPLEMENTATION
+{
+    fprintf(fp, "keys:               %lu\n", stats->key_count);
+    fprintf(fp, "buckets:            %lu (%lu empty)\n", stats->bucket_count, stats->empty_buckets);
+    fprintf(fp, "load factor:        %.3f (max %d)\n", stats->load_factor, CORE_HASHMAP_MAX_LOAD_FACTOR);
+    fprintf(fp, "longest chain:      %lu\n", stats->longest_chain);
+    fprintf(fp, "avg probe length:   %.3f\n", stats->average_probe_length);
+    fprintf(fp, "rehashes:           %lu (%.6fs)\n", stats->rehash_count, stats->rehash_seconds);
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+/*Prints a chain length histogram followed by every bucket and the keys chained in it*/
+void core_hashmap_fprint_buckets(FILE * fp, const core_HashmapBuckets * buckets, const core_HashmapKeys * keys)
+#ifdef CORE_IMPLEMENTATION
+{
+    unsigned long histogram[8] = {0};
+    unsigned long i;
+    for(i = 0; i < buckets->len; ++i) {
+        unsigned long chain = 0;
+        core_HashmapNode * node = buckets->items[i];
+        for(; node; node = node->next) ++chain;
+        ++histogram[CORE_MIN(chain, CORE_ARRAY_LEN(histogram) - 1)];
+    }
+    for(i = 0; i < CORE_ARRAY_LEN(histogram); ++i) {
+        fprintf(fp, "chain %lu%s: %lu buckets\n", i, i + 1 == CORE_ARRAY_LEN(histogram) ? "+" : " ", histogram[i]);
+    }
+    for(i = 0; i < buckets->len; ++i) {
+        core_HashmapNode * node = buckets->items[i];
+        if(!node) continue;
+        fprintf(fp, "[%lu]", i);
+        for(; node; node = node->next) {
+            assert(node->index < keys->len);
+            fprintf(fp, " \"%s\"", keys->items[node->index]);
+        }
+        fprintf(fp, "\n");
+    }
+}
+#else
+;
+#endif /*CORE_IMPLEMENTATION*/
+
+#define core_Hashmap(T) struct { core_Vec(T) values; core_HashmapKeys keys; core_HashmapBuckets buckets; unsigned long index; core_HashmapCounters counters; }
+
+#define core_hashmap_get(self, key)                                                                        \
+    (                                                                                                        \
+        core_hashmap_get_index(&(self)->buckets, &(self)->keys, &(self)->counters, &(self)->index, key)    \
+        ? (&(self)->values.items[(self)->index]) : NULL                                                      \
+    )
+
+#define core_hashmap_getn(self, key, len)                                                                           \
+    (                                                                                                                 \
+        core_hashmap_get_index_n(&(self)->buckets, &(self)->keys, &(self)->counters, &(self)->index, key, len)      \
+        ? (&(self)->values.items[(self)->index]) : NULL                                                               \
     )
 
-#define core_hashmap_set(self, arena, key, value) do {                                              \
-    if(core_hashmap_get(self, key)) {                                                               \
-        (self)->values.items[(self)->index] = value;                                                  \
-    } else {                                                                                          \
-        core_hashmap_record_new_key(&(self)->buckets, arena, &(self)->keys, key, (self)->keys.len); \
-        core_vec_append(&(self)->values, arena, value);                                               \
-        core_vec_append(&(self)->keys, arena, core_arena_strdup(arena, key));                         \
-        assert((self)->values.len == (self)->keys.len);                                               \
-    }                                                                                                 \
+#define core_hashmap_set(self, arena, key, value) do {                                                                  \
+    if(core_hashmap_get(self, key)) {                                                                                   \
+        (self)->values.items[(self)->index] = value;                                                                      \
+    } else {                                                                                                              \
+        core_hashmap_record_new_key(&(self)->buckets, arena, &(self)->keys, &(self)->counters, key, (self)->keys.len);  \
+        core_vec_append(&(self)->values, arena, value);                                                                   \
+        core_vec_append(&(self)->keys, arena, core_arena_strdup(arena, key));                                             \
+        assert((self)->values.len == (self)->keys.len);                                                                   \
+    }                                                                                                                     \
+} while (0)
+
+#define core_hashmap_stats(self, out) core_hashmap_compute_stats(&(self)->buckets, &(self)->keys, &(self)->counters, out)
+
+#define core_hashmap_dump(self, fp) do {                                   \
+    core_HashmapStats core_hashmap_dump_stats_;                             \
+    core_hashmap_stats(self, &core_hashmap_dump_stats_);                    \
+    core_hashmap_fprint_stats(fp, &core_hashmap_dump_stats_);               \
+    core_hashmap_fprint_buckets(fp, &(self)->buckets, &(self)->keys);       \
 } while (0)
@@ -0,0 +1,534 @@
+/*
+  lexgen: compiles a lexical spec (see c89.lex) into DFA tables for main.c
+
+  usage: lexgen <spec> <output.h>
+
+  Each rule's pattern is turned into a Thompson NFA, the NFAs are joined
+  under one start state and determinized by subset construction. Bytes
+  that behave identically in every state are merged into classes so the
+  transition table stays small.
+*/
+
+#define CORE_IMPLEMENTATION
+#include "core.h"
+
+#define MAX_RULES 256
+#define MAX_LINE 1024
+
+typedef struct {
+    unsigned char bits[32];
+} ByteSet;
+
+#define byteset_add(set, c) ((set)->bits[(unsigned char)(c) >> 3] |= (unsigned char)(1 << ((unsigned char)(c) & 7)))
+#define byteset_has(set, c) (((set)->bits[(unsigned char)(c) >> 3] >> ((unsigned char)(c) & 7)) & 1)
+
+typedef struct {
+    ByteSet on; /*bytes that move to `to`*/
+    core_Bool has_on;
+    int to;
+    int eps[2]; /*epsilon targets, -1 if unused*/
+    int accept; /*rule index, -1 if not accepting*/
+} NfaState;
+
+typedef struct {
+    int start;
+    int end;
+} Fragment;
+
+typedef struct {
+    char tag[64];
+    int tag_index; /*index into the emitted token list, -2 for SKIP*/
+} Rule;
+
+static core_Arena arena = {0};
+static core_Vec(NfaState) nfa = {0};
+static Rule rules[MAX_RULES];
+static int rule_count = 0;
+static char tags[MAX_RULES][64];
+static const char * spellings[MAX_RULES]; /*fixed text of tags matched by a plain literal*/
+static int tag_count = 0;
+
+static const char * spec_path = NULL;
+static int spec_line = 0;
+
+static CORE_NORETURN void die(const char * msg) {
+    fprintf(stderr, "%s:%d: %s\n", spec_path, spec_line, msg);
+    core_exit(1);
+}
+
+static int nfa_new(void) {
+    NfaState s;
+    memset(&s, 0, sizeof(s));
+    s.to = -1;
+    s.eps[0] = -1;
+    s.eps[1] = -1;
+    s.accept = -1;
+    core_vec_append(&nfa, &arena, s);
+    return (int)nfa.len - 1;
+}
+
+static void nfa_eps(int from, int to) {
+    NfaState * s = &nfa.items[from];
+    assert(!s->has_on);
+    if(s->eps[0] < 0) s->eps[0] = to;
+    else if(s->eps[1] < 0) s->eps[1] = to;
+    else CORE_UNREACHABLE;
+}
+
+static Fragment frag_set(const ByteSet * set) {
+    Fragment f;
+    f.start = nfa_new();
+    f.end = nfa_new();
+    nfa.items[f.start].on = *set;
+    nfa.items[f.start].has_on = CORE_TRUE;
+    nfa.items[f.start].to = f.end;
+    return f;
+}
+
+static Fragment frag_byte(unsigned char c) {
+    ByteSet set;
+    memset(&set, 0, sizeof(set));
+    byteset_add(&set, c);
+    return frag_set(&set);
+}
+
+static Fragment frag_empty(void) {
+    Fragment f;
+    f.start = nfa_new();
+    f.end = nfa_new();
+    nfa_eps(f.start, f.end);
+    return f;
+}
+
+static Fragment frag_concat(Fragment a, Fragment b) {
+    Fragment f;
+    nfa_eps(a.end, b.start);
+    f.start = a.start;
+    f.end = b.end;
+    return f;
+}
+
+static Fragment frag_alt(Fragment a, Fragment b) {
+    Fragment f;
+    f.start = nfa_new();
+    f.end = nfa_new();
+    nfa_eps(f.start, a.start);
+    nfa_eps(f.start, b.start);
+    nfa_eps(a.end, f.end);
+    nfa_eps(b.end, f.end);
+    return f;
+}
+
+static Fragment frag_repeat(Fragment a, char op) {
+    Fragment f;
+    f.start = nfa_new();
+    f.end = nfa_new();
+    nfa_eps(f.start, a.start);
+    if(op != '+') nfa_eps(f.start, f.end);
+    if(op != '?') nfa_eps(a.end, a.start);
+    nfa_eps(a.end, f.end);
+    return f;
+}
+
+/**** PATTERN PARSER ****/
+
+static unsigned char parse_escape(const char ** re) {
+    char ch = **re;
+    if(ch == 0) die("Trailing '\\' in pattern");
+    ++*re;
+    switch(ch) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'v': return '\v';
+    case 'f': return '\f';
+    case '0': return '\0';
+    default: return (unsigned char)ch;
+    }
+}
+
+static Fragment parse_alt(const char ** re);
+
+static Fragment parse_class(const char ** re) {
+    ByteSet set;
+    core_Bool negate = CORE_FALSE;
+    memset(&set, 0, sizeof(set));
+    if(**re == '^') {
+        negate = CORE_TRUE;
+        ++*re;
+    }
+    while(**re != ']') {
+        unsigned char lo, hi;
+        unsigned int c;
+        if(**re == 0) die("Unterminated '['");
+        lo = (unsigned char)*(*re)++;
+        if(lo == '\\') lo = parse_escape(re);
+        hi = lo;
+        if(**re == '-' && (*re)[1] != ']' && (*re)[1] != 0) {
+            ++*re;
+            hi = (unsigned char)*(*re)++;
+            if(hi == '\\') hi = parse_escape(re);
+        }
+        if(hi < lo) die("Invalid range in '[]'");
+        for(c = lo; c <= hi; ++c) byteset_add(&set, c);
+    }
+    ++*re;
+    if(negate) {
+        unsigned int i;
+        for(i = 0; i < sizeof(set.bits); ++i) set.bits[i] = (unsigned char)~set.bits[i];
+    }
+    return frag_set(&set);
+}
+
+static Fragment parse_atom(const char ** re) {
+    char ch = *(*re)++;
+    switch(ch) {
+    case '(': {
+        Fragment f = parse_alt(re);
+        if(**re != ')') die("Expected ')'");
+        ++*re;
+        return f;
+    }
+    case '[':
+        return parse_class(re);
+    case '.': {
+        ByteSet set;
+        memset(&set, 0xFF, sizeof(set));
+        set.bits['\n' >> 3] &= (unsigned char)~(1 << ('\n' & 7));
+        return frag_set(&set);
+    }
+    case '"': {
+        Fragment f = frag_empty();
+        while(**re != '"') {
+            unsigned char c;
+            if(**re == 0) die("Unterminated literal");
+            c = (unsigned char)*(*re)++;
+            if(c == '\\') c = parse_escape(re);
+            f = frag_concat(f, frag_byte(c));
+        }
+        ++*re;
+        return f;
+    }
+    case '\\':
+        return frag_byte(parse_escape(re));
+    case '*': case '+': case '?': case '|': case ')': case 0:
+        die("Unexpected operator in pattern");
+    default:
+        return frag_byte((unsigned char)ch);
+    }
+}
+
+static Fragment parse_repeat(const char ** re) {
+    Fragment f = parse_atom(re);
+    while(**re == '*' || **re == '+' || **re == '?') {
+        f = frag_repeat(f, *(*re)++);
+    }
+    return f;
+}
+
+static Fragment parse_concat(const char ** re) {
+    Fragment f = frag_empty();
+    while(**re != 0 && **re != '|' && **re != ')') {
+        f = frag_concat(f, parse_repeat(re));
+    }
+    return f;
+}
+
+static Fragment parse_alt(const char ** re) {
+    Fragment f = parse_concat(re);
+    while(**re == '|') {
+        ++*re;
+        f = frag_alt(f, parse_concat(re));
+    }
+    return f;
+}
+
+/**** SPEC ****/
+
+static int tag_intern(const char * tag) {
+    int i;
+    if(core_streql(tag, "SKIP")) return -2;
+    for(i = 0; i < tag_count; ++i) {
+        if(core_streql(tags[i], tag)) return i;
+    }
+    strcpy(tags[tag_count], tag);
+    return tag_count++;
+}
+
+/*Returns the text matched by a pattern that is a single "..." literal, NULL otherwise*/
+static const char * literal_spelling(const char * re) {
+    const char * end;
+    if(re[0] != '"') return NULL;
+    end = strchr(re + 1, '"');
+    if(!end || end[1] != 0 || memchr(re + 1, '\\', (size_t)(end - re - 1))) return NULL;
+    return core_arena_strndup(&arena, re + 1, (size_t)(end - re - 1));
+}
+
+/*Parses the spec and returns the NFA start state*/
+static int read_spec(FILE * fp) {
+    char line[MAX_LINE];
+    int start = nfa_new();
+    int last = start; /*chain of epsilon fan-out states*/
+    while(fgets(line, sizeof(line), fp)) {
+        char * p = line;
+        char * tag;
+        const char * re;
+        Fragment f;
+        size_t len = strlen(line);
+        ++spec_line;
+        while(len > 0 && CORE_CTYPE_IS(line[len - 1], CORE_CTYPE_SPACE)) line[--len] = 0;
+        while(CORE_CTYPE_IS(*p, CORE_CTYPE_SPACE)) ++p;
+        if(*p == 0 || *p == '#') continue;
+        if(rule_count >= MAX_RULES) die("Too many rules");
+
+        tag = p;
+        while(*p && !CORE_CTYPE_IS(*p, CORE_CTYPE_SPACE)) ++p;
+        if(*p == 0) die("Expected pattern after tag");
+        *p++ = 0;
+        while(CORE_CTYPE_IS(*p, CORE_CTYPE_SPACE)) ++p;
+        if(strlen(tag) >= sizeof(rules[0].tag)) die("Tag too long");
+
+        strcpy(rules[rule_count].tag, tag);
+        rules[rule_count].tag_index = tag_intern(tag);
+        if(rules[rule_count].tag_index >= 0 && !spellings[rules[rule_count].tag_index]) {
+            spellings[rules[rule_count].tag_index] = literal_spelling(p);
+        }
+
+        re = p;
+        f = parse_alt(&re);
+        if(*re != 0) die("Unbalanced ')'");
+        nfa.items[f.end].accept = rule_count;
+
+        {
+            int fork = nfa_new();
+            nfa_eps(last, fork);
+            nfa_eps(fork, f.start);
+            last = fork;
+        }
+        ++rule_count;
+    }
+    return start;
+}
+
+/**** SUBSET CONSTRUCTION ****/
+
+typedef unsigned char * StateSet;
+
+static unsigned long set_bytes = 0;
+static core_Vec(StateSet) dfa_sets = {0};
+static core_Vec(unsigned int *) dfa_next = {0}; /*256 entries per state*/
+
+static void closure(StateSet set) {
+    static core_Vec(int) stack = {0};
+    unsigned long i;
+    stack.len = 0;
+    for(i = 0; i < nfa.len; ++i) {
+        if((set[i >> 3] >> (i & 7)) & 1) core_vec_append(&stack, &arena, (int)i);
+    }
+    while(stack.len > 0) {
+        const NfaState * s = &nfa.items[stack.items[--stack.len]];
+        int j;
+        for(j = 0; j < 2; ++j) {
+            const int t = s->eps[j];
+            if(t < 0 || ((set[t >> 3] >> (t & 7)) & 1)) continue;
+            set[t >> 3] |= (unsigned char)(1 << (t & 7));
+            core_vec_append(&stack, &arena, t);
+        }
+    }
+}
+
+static unsigned int dfa_find_or_add(StateSet set) {
+    unsigned long i;
+    StateSet copy;
+    for(i = 0; i < dfa_sets.len; ++i) {
+        if(memcmp(dfa_sets.items[i], set, set_bytes) == 0) return (unsigned int)i;
+    }
+    copy = core_arena_alloc(&arena, set_bytes);
+    memcpy(copy, set, set_bytes);
+    core_vec_append(&dfa_sets, &arena, copy);
+    return dfa_sets.len - 1;
+}
+
+static int dfa_accept(unsigned int state) {
+    const StateSet set = dfa_sets.items[state];
+    int best = -1;
+    unsigned long i;
+    for(i = 0; i < nfa.len; ++i) {
+        const int accept = nfa.items[i].accept;
+        if(accept < 0 || !((set[i >> 3] >> (i & 7)) & 1)) continue;
+        if(best < 0 || accept < best) best = accept;
+    }
+    return best < 0 ? -1 : rules[best].tag_index;
+}
+
+static void build_dfa(int nfa_start) {
+    StateSet set;
+    unsigned long state;
+    set_bytes = (nfa.len + 7) / 8;
+    set = core_arena_alloc(&arena, set_bytes);
+
+    /*state 0 is the dead state, state 1 the start state*/
+    memset(set, 0, set_bytes);
+    (void)dfa_find_or_add(set);
+    set[nfa_start >> 3] |= (unsigned char)(1 << (nfa_start & 7));
+    closure(set);
+    (void)dfa_find_or_add(set);
+
+    for(state = 0; state < dfa_sets.len; ++state) {
+        unsigned int * row = core_arena_alloc(&arena, 256 * sizeof(unsigned int));
+        unsigned int c;
+        for(c = 0; c < 256; ++c) {
+            unsigned long i;
+            memset(set, 0, set_bytes);
+            for(i = 0; i < nfa.len; ++i) {
+                const NfaState * s = &nfa.items[i];
+                if(!((dfa_sets.items[state][i >> 3] >> (i & 7)) & 1)) continue;
+                if(s->has_on && byteset_has(&s->on, c)) {
+                    set[s->to >> 3] |= (unsigned char)(1 << (s->to & 7));
+                }
+            }
+            closure(set);
+            row[c] = dfa_find_or_add(set);
+        }
+        core_vec_append(&dfa_next, &arena, row);
+    }
+}
+
+/**** OUTPUT ****/
+
+static int is_identifier(unsigned int c) { return core_isidentifier((char)c); }
+static int is_xdigit(unsigned int c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+static int is_digit(unsigned int c) { return c >= '0' && c <= '9'; }
+
+/*true if every byte matching pred keeps the DFA in `state`, so a run of
+  such bytes can be skipped by a bulk scanner*/
+static core_Bool loops_on(unsigned long state, int (*pred)(unsigned int c)) {
+    unsigned int c;
+    for(c = 0; c < 256; ++c) {
+        if(pred(c) && dfa_next.items[state][c] != state) return CORE_FALSE;
+    }
+    return CORE_TRUE;
+}
+
+static void emit(FILE * out) {
+    unsigned int byte_class[256];
+    unsigned int class_rep[256];
+    unsigned int class_count = 0;
+    unsigned int c, i;
+    unsigned long state;
+
+    /*bytes with identical columns share a class*/
+    for(c = 0; c < 256; ++c) {
+        for(i = 0; i < class_count; ++i) {
+            unsigned int rep = class_rep[i];
+            for(state = 0; state < dfa_next.len; ++state) {
+                if(dfa_next.items[state][c] != dfa_next.items[state][rep]) break;
+            }
+            if(state == dfa_next.len) break;
+        }
+        if(i == class_count) class_rep[class_count++] = c;
+        byte_class[c] = i;
+    }
+
+    fprintf(out, "/* Generated by lexgen from %s, do not edit */\n\n", spec_path);
+    fprintf(out, "#define DO_LEXER_TOKENS(x) \\\n");
+    for(i = 0; i < (unsigned int)tag_count; ++i) {
+        fprintf(out, "    x(%s)%s\n", tags[i], i + 1 < (unsigned int)tag_count ? " \\" : "");
+    }
+    fprintf(out, "\n#define DFA_ERROR 0\n");
+    fprintf(out, "#define DFA_START 1\n");
+    fprintf(out, "#define DFA_STATE_COUNT %lu\n", (unsigned long)dfa_next.len);
+    fprintf(out, "#define DFA_CLASS_COUNT %u\n", class_count);
+    fprintf(out, "#define DFA_NO_ACCEPT (-1)\n");
+    fprintf(out, "#define DFA_SKIP (-2)\n");
+    fprintf(out, "#define DFA_FAST_NONE 0\n");
+    fprintf(out, "#define DFA_FAST_IDENTIFIER 1\n");
+    fprintf(out, "#define DFA_FAST_XDIGITS 2\n");
+    fprintf(out, "#define DFA_FAST_DIGITS 3\n\n");
+
+    fprintf(out, "static const unsigned char dfa_class[256] = {");
+    for(c = 0; c < 256; ++c) {
+        fprintf(out, "%s%3u,", c % 16 == 0 ? "\n    " : " ", byte_class[c]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const %s dfa_next[DFA_STATE_COUNT][DFA_CLASS_COUNT] = {\n",
+            dfa_next.len <= 256 ? "unsigned char" : "unsigned short");
+    for(state = 0; state < dfa_next.len; ++state) {
+        fprintf(out, "    {");
+        for(i = 0; i < class_count; ++i) {
+            fprintf(out, "%s%u", i == 0 ? "" : ",", dfa_next.items[state][class_rep[i]]);
+        }
+        fprintf(out, "},\n");
+    }
+    fprintf(out, "};\n\n");
+
+    /*accepting states hold an index into DO_LEXER_TOKENS*/
+    fprintf(out, "static const short dfa_accept[DFA_STATE_COUNT] = {\n");
+    for(state = 0; state < dfa_next.len; ++state) {
+        const int accept = dfa_accept((unsigned int)state);
+        fprintf(out, "    %d,", accept);
+        if(accept >= 0) fprintf(out, " /*%s*/", tags[accept]);
+        else if(accept == -2) fprintf(out, " /*SKIP*/");
+        fprintf(out, "\n");
+    }
+    fprintf(out, "};\n\n");
+
+    /*tokens that are always spelled the same, so their text need not be kept*/
+    fprintf(out, "static const char * const dfa_spelling[] = {\n");
+    for(i = 0; i < (unsigned int)tag_count; ++i) {
+        const char * c;
+        if(!spellings[i]) {
+            fprintf(out, "    NULL, /*%s*/\n", tags[i]);
+            continue;
+        }
+        fprintf(out, "    \"");
+        for(c = spellings[i]; *c; ++c) {
+            if(*c == '"' || *c == '\\') fputc('\\', out);
+            fputc(*c, out);
+        }
+        fprintf(out, "\",\n");
+    }
+    fprintf(out, "};\n\n");
+
+    /*states that loop on a whole byte class get a bulk scanner*/
+    fprintf(out, "static const unsigned char dfa_fast[DFA_STATE_COUNT] = {");
+    for(state = 0; state < dfa_next.len; ++state) {
+        int fast = 0;
+        if(state == 0) fast = 0;
+        else if(loops_on(state, is_identifier)) fast = 1;
+        else if(loops_on(state, is_xdigit)) fast = 2;
+        else if(loops_on(state, is_digit)) fast = 3;
+        fprintf(out, "%s%d,", state % 32 == 0 ? "\n    " : " ", fast);
+    }
+    fprintf(out, "\n};\n");
+}
+
+int main(int argc, char ** argv) {
+    FILE * fp;
+    FILE * out;
+    int start;
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <spec> <output.h>\n", argv[0]);
+        return 1;
+    }
+    spec_path = argv[1];
+    fp = fopen(spec_path, "r");
+    if(!fp) {
+        fprintf(stderr, "Failed to open file: '%s'\n", spec_path);
+        return 1;
+    }
+    start = read_spec(fp);
+    fclose(fp);
+    build_dfa(start);
+
+    out = fopen(argv[2], "w");
+    if(!out) {
+        fprintf(stderr, "Failed to open file: '%s'\n", argv[2]);
+        return 1;
+    }
+    emit(out);
+    fclose(out);
+    core_arena_free(&arena);
+    return 0;
+}
@@ -1,35 +1,47 @@
 #include <ctype.h>
 #include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define CORE_IMPLEMENTATION
 #include "core.h"
 
 #define streql core_streql
-#define QUIT CORE_FATAL_ERROR
 
-typedef struct SrcInfo SrcInfo;
-struct SrcInfo {
-    SrcInfo * parent;
+/*Widths of the target's types, which need not be the host's. The host's
+  unsigned long must be at least a target long wide*/
+#define TARGET_CHAR_BITS 8 /*plain char is signed*/
+#define TARGET_SHORT_BITS 16
+#define TARGET_INT_BITS 32
+#define TARGET_LONG_BITS 64 /*a cell, also the width of pointers and size_t*/
+
+/*largest unsigned value of a target type `bits` wide, halve it for the signed one*/
+#define target_umax(bits) (~0UL >> (sizeof(unsigned long) * CHAR_BIT - (bits)))
+
+/*Every loaded file occupies a range of one global offset space, so a single
+  32 bit offset identifies a location. See SourceManager*/
+typedef unsigned int SrcLoc;
+
+#define SRCLOC_NONE ((SrcLoc)-1) /*never inside a file, see srcmgr_add*/
+
+/*Resolved form of a SrcLoc, only computed for diagnostics*/
+typedef struct {
     const char * file;
     long line;
     long col;
-};
+} SrcInfo;
+
+/*Token tags come from c89.lex, see lexgen.c. They must stay first in
+  TokenTag since the DFA accept table stores their positions*/
+#include "lexer_dfa.h"
 
 #define DO_TOKENS(x)            \
-    x(TOK_IDENTIFIER)           \
-                                \
-    /*Keywords*/                \
-    x(TOK_INT)                  \
-    x(TOK_RETURN)               \
-                                \
-    /*Syntactic elements*/      \
-    x(TOK_OPEN_PARENS)          \
-    x(TOK_CLOSE_PARENS)         \
-    x(TOK_OPEN_BRACE)           \
-    x(TOK_CLOSE_BRACE)          \
-    x(TOK_PLUS)                 \
-    x(TOK_SEMICOLON)            \
-    x(TOK_COMMA)                
+    DO_LEXER_TOKENS(x)          \
+    x(TOK_EOF) /*end of input, never produced by the lexer*/
 
 #define ENUM_MEMBER(a) a,
 #define ENUM_NAME(a) #a,
@@ -44,306 +56,5210 @@ const char * token_tag_names[] = {
     NULL
 };
 
+typedef core_Slice(const char) Str; /*points into a source buffer, not NUL terminated*/
+
+#define STR_FMT "%.*s"
+#define STR_ARG(s) (int)(s).len, (s).ptr
+#define str_eq(a, b) ((a).len == (b).len && memcmp((a).ptr, (b).ptr, (a).len) == 0)
+
+/*C89 types an integer constant by its suffix, base and value*/
+typedef enum {
+    INT_LITERAL_INT,
+    INT_LITERAL_UNSIGNED_INT,
+    INT_LITERAL_LONG,
+    INT_LITERAL_UNSIGNED_LONG
+} IntLiteralType;
+
+/*Macros a token was expanded from, as sorted symbols of the macro table.
+  Shared between tokens and never modified, NULL when empty. See Preprocessor*/
+typedef struct {
+    const core_Symbol * syms;
+    unsigned int len;
+} HideSet;
+
+#define TOKEN_BOL 0x01 /*first token on its line*/
+#define TOKEN_SPACE 0x02 /*preceded by whitespace or a comment*/
+#define TOKEN_NO_EXPAND 0x04 /*replayed from a memoized expansion, already fully expanded*/
+
 typedef struct {
     TokenTag tag;
-    const char * identifier;
+    unsigned char flags;
+    Str text; /*spelling of the token*/
+    IntLiteralType int_type; /*TOK_INT_LITERAL*/
+    unsigned long value; /*TOK_INT_LITERAL, converted by the lexer*/
+    const HideSet * hideset;
 
-    SrcInfo src; /*For reporting error messages about where the error came from*/
+    SrcLoc loc; /*For reporting error messages about where the error came from*/
 } Token;
 
 typedef core_Vec(Token) Tokens;
 
+core_Bool token_has_text(TokenTag tag) {
+    switch(tag) {
+    case TOK_IDENTIFIER:
+    case TOK_INT_LITERAL:
+    case TOK_FLOAT_LITERAL:
+    case TOK_CHAR_LITERAL:
+    case TOK_STRING_LITERAL:
+        return CORE_TRUE;
+    default:
+        return CORE_FALSE;
+    }
+}
+
 void token_fprint(FILE * fp, Token tok) {
-    switch(tok.tag) {
+    if((unsigned int)tok.tag >= TOK_COUNT) {
+        fprintf(fp, "TOK_<UNKNOWN:%d>", tok.tag);
+        return;
+    }
+    fprintf(fp, "%s", token_tag_names[tok.tag]);
+    if(tok.tag == TOK_INT_LITERAL) fprintf(fp, "(" STR_FMT " = %lu)", STR_ARG(tok.text), tok.value);
+    else if(token_has_text(tok.tag)) fprintf(fp, "(" STR_FMT ")", STR_ARG(tok.text));
+}
+
+void token_print(Token tok) {token_fprint(stdout, tok);}
 
-    case TOK_IDENTIFIER: fprintf(fp, "TOK_IDENTIFIER(%s)", tok.identifier); break;
+/**** SOURCE MANAGER ****/
 
-    /* Keywords */
-    case TOK_INT: fprintf(fp, "TOK_INT"); break;
-    case TOK_RETURN: fprintf(fp, "TOK_RETURN"); break;
+typedef struct {
+    const char * path;
+    const char * buf; /*NUL terminated*/
+    unsigned int len;
+    SrcLoc base;
+    core_Vec(unsigned int) line_starts; /*built on the first lookup*/
+    core_Vec(unsigned int) splices; /*offsets a backslash-newline was removed at, each starts a line*/
+} SourceFile;
 
-    /* Syntactic elements */
-    case TOK_OPEN_PARENS: fprintf(fp, "TOK_OPEN_PARENS"); break;
-    case TOK_CLOSE_PARENS: fprintf(fp, "TOK_CLOSE_PARENS"); break;
-    case TOK_OPEN_BRACE: fprintf(fp, "TOK_OPEN_BRACE"); break;
-    case TOK_CLOSE_BRACE: fprintf(fp, "TOK_CLOSE_BRACE"); break;
-    case TOK_PLUS: fprintf(fp, "TOK_PLUS"); break;
-    case TOK_SEMICOLON: fprintf(fp, "TOK_SEMICOLON"); break;
-    case TOK_COMMA: fprintf(fp, "TOK_COMMA"); break;
+typedef struct Diagnostics Diagnostics; /*see DIAGNOSTICS*/
 
-    default: fprintf(fp, "TOK_<UNKNOWN:%d>", tok.tag); break;
-    }
+typedef struct {
+    core_Arena * arena;
+    Diagnostics * diag; /*where problems with the input are reported*/
+    core_Vec(SourceFile) files; /*sorted by base*/
+    SrcLoc next_base;
+} SourceManager;
+
+CORE_NORETURN void diag_fatal(Diagnostics * d, SrcLoc loc, const char * msg);
+void diag_report_str(Diagnostics * d, SrcLoc loc, const char * msg, Str s);
+
+void srcmgr_init(SourceManager * sm, core_Arena * a, Diagnostics * diag) {
+    memset(sm, 0, sizeof(*sm));
+    sm->arena = a;
+    sm->diag = diag;
 }
 
-void token_print(Token tok) {token_fprint(stdout, tok);}
+/*Registers a buffer and returns its file index. The byte after the end
+  keeps its own offset so end of file locations stay inside the file*/
+unsigned int srcmgr_add(SourceManager * sm, const char * path, const char * buf, size_t len) {
+    SourceFile f;
+    memset(&f, 0, sizeof(f));
+    if(len >= (size_t)(UINT_MAX - sm->next_base)) diag_fatal(sm->diag, SRCLOC_NONE, "Source offset space exhausted");
+    f.path = core_arena_strdup(sm->arena, path);
+    f.buf = buf;
+    f.len = (unsigned int)len;
+    f.base = sm->next_base;
+    sm->next_base += f.len + 1;
+    core_vec_append(&sm->files, sm->arena, f);
+    return sm->files.len - 1;
+}
 
-core_Bool lex_token(core_Arena * a, FILE * fp, Token * result, SrcInfo * src) {
-    char ch = 0;
+/*Streams do not know their length up front, so they reserve this much of
+  the offset space and their line table is filled in as blocks arrive*/
+#define SRCMGR_STREAM_RESERVE (1u << 30)
 
-    while(isspace(core_peek(fp))) {
-        if(core_peek(fp) == '\n') {
-            ++src->line;
-            src->col = 1;
-        } else {
-            ++src->col;
-        }
-        fgetc(fp);
-    }
-
-    result->src = *src;
-
-    if(feof(fp)) return CORE_FALSE;
-    ch = fgetc(fp);
-    ++src->col;
-    
-    if(ch == '(') {
-        result->tag = TOK_OPEN_PARENS;
-    } else if (ch == ')') {
-        result->tag = TOK_CLOSE_PARENS;
-    } else if(ch == '{') {
-        result->tag = TOK_OPEN_BRACE;
-    } else if(ch == '}') {
-        result->tag = TOK_CLOSE_BRACE;
-    } else if(ch == '+') {
-        result->tag = TOK_PLUS;
-    } else if(ch == ';') {
-        result->tag = TOK_SEMICOLON;
-    } else if(ch == ',') {
-        result->tag = TOK_COMMA;
-    } else if(isalpha(ch)) {
-        char buf[1024];
-        unsigned long i = 0;
-        while(core_isidentifier(ch)) {
-            assert(sizeof(buf) > i + 1);
-            buf[i] = ch;
-            buf[i+1] = 0;
-            ++i;
-            ch = fgetc(fp);
-            ++src->col;
-        }
-        ungetc(ch, fp);
-        if(streql(buf, "int")) {
-            result->tag = TOK_INT;
-        } else if(streql(buf, "return")) {
-            result->tag = TOK_RETURN;
-        } else {
-            result->tag = TOK_IDENTIFIER;
-            result->identifier = core_arena_strdup(a, buf);
+unsigned int srcmgr_add_stream(SourceManager * sm, const char * name) {
+    SourceFile f;
+    memset(&f, 0, sizeof(f));
+    if(SRCMGR_STREAM_RESERVE >= UINT_MAX - sm->next_base) diag_fatal(sm->diag, SRCLOC_NONE, "Source offset space exhausted");
+    f.path = core_arena_strdup(sm->arena, name);
+    f.base = sm->next_base;
+    sm->next_base += SRCMGR_STREAM_RESERVE;
+    core_vec_append(&f.line_starts, sm->arena, 0);
+    core_vec_append(&sm->files, sm->arena, f);
+    return sm->files.len - 1;
+}
+
+/*Records newly streamed bytes that start at `offset` within the file*/
+void srcmgr_stream_append(SourceManager * sm, unsigned int file, unsigned int offset, const char * bytes, size_t len) {
+    SourceFile * f = &sm->files.items[file];
+    const char * p = bytes;
+    const char * end = bytes + len;
+    if(len >= (size_t)(SRCMGR_STREAM_RESERVE - offset)) diag_fatal(sm->diag, SRCLOC_NONE, "Streamed input too large");
+    while((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        ++p;
+        core_vec_append(&f->line_starts, sm->arena, offset + (unsigned int)(p - bytes));
+    }
+    f->len = offset + (unsigned int)len;
+}
+
+/*Translation phase 2: removes every backslash-newline from `bytes`, which
+  sit at `offset` in the file, and returns their new length. The removed
+  newlines are kept in the file's splices for srcmgr_resolve*/
+size_t srcmgr_splice(SourceManager * sm, unsigned int file, char * bytes, size_t len, unsigned int offset) {
+    SourceFile * f = &sm->files.items[file];
+    const char * end = bytes + len;
+    const char * p = bytes;
+    char * out = NULL;
+    const char * next;
+    while((next = memchr(p, '\\', (size_t)(end - p))) != NULL) {
+        if(next + 1 == end || next[1] != '\n') {
+            next += 1;
+            if(out) {
+                memmove(out, p, (size_t)(next - p));
+                out += next - p;
+            }
+            p = next;
+            continue;
         }
-    } else {
-        fprintf(stderr, "Invalid Token: %c\n", ch);
-        return CORE_FALSE;
+        if(!out) out = (char *)next;
+        else {
+            memmove(out, p, (size_t)(next - p));
+            out += next - p;
+        }
+        core_vec_append(&f->splices, sm->arena, offset + (unsigned int)(out - bytes));
+        p = next + 2;
     }
-    return CORE_TRUE;
+    if(!out) return len;
+    memmove(out, p, (size_t)(end - p));
+    out += end - p;
+    *out = 0;
+    return (size_t)(out - bytes);
 }
 
-Tokens tokenize_file(core_Arena * a, const char * path) {
-   FILE * fp = NULL;
-   Tokens t = {0};
-   SrcInfo src = {0};
+/*Returns the file index or -1 if the file could not be read*/
+long srcmgr_load(SourceManager * sm, const char * path) {
+    size_t len = 0;
+    char * buf = (char *)core_file_read_all_arena_len(sm->arena, path, &len);
+    unsigned int file;
+    if(!buf) {
+        Str name;
+        name.ptr = path;
+        name.len = strlen(path);
+        diag_report_str(sm->diag, SRCLOC_NONE, "Failed to open file", name);
+        return -1;
+    }
+    file = srcmgr_add(sm, path, buf, len);
+    sm->files.items[file].len = (unsigned int)srcmgr_splice(sm, file, buf, len, 0);
+    return (long)file;
+}
+
+SourceFile * srcmgr_file(SourceManager * sm, SrcLoc loc) {
+    unsigned int lo = 0;
+    unsigned int hi = sm->files.len;
+    assert(sm->files.len > 0);
+    while(hi - lo > 1) {
+        const unsigned int mid = lo + (hi - lo) / 2;
+        if(sm->files.items[mid].base <= loc) lo = mid;
+        else hi = mid;
+    }
+    return &sm->files.items[lo];
+}
+
+void srcmgr_build_line_starts(SourceManager * sm, SourceFile * f) {
+    const char * p = f->buf;
+    const char * end = f->buf + f->len;
+    const unsigned long lines = core_count_newlines(p, end) + 1;
+    f->line_starts.len = 0;
+    f->line_starts.cap = (unsigned int)lines + 1;
+    f->line_starts.items = core_arena_alloc(sm->arena, sizeof(f->line_starts.items[0]) * f->line_starts.cap);
+    f->line_starts.items[f->line_starts.len++] = 0;
+    while((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        ++p;
+        f->line_starts.items[f->line_starts.len++] = (unsigned int)(p - f->buf);
+    }
+    assert(f->line_starts.len == lines);
+}
+
+/*number of offsets in the sorted `items` that are at or before `offset`*/
+unsigned int srcmgr_count_upto(const unsigned int * items, unsigned int len, unsigned int offset) {
+    unsigned int lo = 0;
+    unsigned int hi = len;
+    while(lo < hi) {
+        const unsigned int mid = lo + (hi - lo) / 2;
+        if(items[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*Lines are counted in the file as written, so a line spliced onto the
+  one before it still has its own number*/
+SrcInfo srcmgr_resolve(SourceManager * sm, SrcLoc loc) {
+    SrcInfo info;
+    SourceFile * f = srcmgr_file(sm, loc);
+    const unsigned int offset = loc - f->base;
+    unsigned int line;
+    unsigned int spliced;
+    unsigned int start;
+    if(f->line_starts.len == 0) srcmgr_build_line_starts(sm, f);
+    line = srcmgr_count_upto(f->line_starts.items, f->line_starts.len, offset) - 1;
+    spliced = srcmgr_count_upto(f->splices.items, f->splices.len, offset);
+    start = f->line_starts.items[line];
+    if(spliced > 0 && f->splices.items[spliced - 1] > start) start = f->splices.items[spliced - 1];
+    info.file = f->path;
+    info.line = (long)(line + spliced) + 1;
+    info.col = (long)(offset - start) + 1;
+    return info;
+}
+
+void srcmgr_fprint_loc(FILE * fp, SourceManager * sm, SrcLoc loc) {
+    const SrcInfo info = srcmgr_resolve(sm, loc);
+    fprintf(fp, "%s:%ld:%ld", info.file, info.line, info.col);
+}
+
+/**** DIAGNOSTICS ****/
+
+/*Errors are collected rather than printed, and none of them exits the
+  process, so a host can run many compiles and read back what went wrong.
+  An error the compile cannot go on from unwinds to whoever set `bail`,
+  anything it leaves behind is in the arena of the compile*/
+typedef struct {
+    SrcLoc loc; /*SRCLOC_NONE if it is about no place in the input*/
+    const char * msg; /*a literal or in the arena of the Diagnostics*/
+} Diagnostic;
+
+struct Diagnostics {
+    SourceManager * sm;
+    core_Arena * arena;
+    core_Vec(Diagnostic) items;
+    FILE * echo; /*when set, each diagnostic is also printed here as it is reported*/
+    jmp_buf * bail; /*where diag_fatal unwinds to, the process exits if not set*/
+};
+
+void diag_init(Diagnostics * d, SourceManager * sm, core_Arena * a, FILE * echo) {
+    memset(d, 0, sizeof(*d));
+    d->sm = sm;
+    d->arena = a;
+    d->echo = echo;
+}
+
+void diag_fprint(FILE * fp, SourceManager * sm, const Diagnostic * d) {
+    if(d->loc != SRCLOC_NONE) {
+        srcmgr_fprint_loc(fp, sm, d->loc);
+        fprintf(fp, ": ");
+    }
+    fprintf(fp, "%s\n", d->msg);
+}
+
+void diag_report(Diagnostics * d, SrcLoc loc, const char * msg) {
+    Diagnostic diag;
+    diag.loc = loc;
+    diag.msg = msg;
+    core_vec_append(&d->items, d->arena, diag);
+    if(d->echo) diag_fprint(d->echo, d->sm, &diag);
+}
+
+/*Reports `msg: 's'`*/
+void diag_report_str(Diagnostics * d, SrcLoc loc, const char * msg, Str s) {
+    char * text = core_arena_alloc(d->arena, strlen(msg) + s.len + 5);
+    sprintf(text, "%s: '" STR_FMT "'", msg, STR_ARG(s));
+    diag_report(d, loc, text);
+}
+
+/*Abandons the work `d` collects for, after its errors have been reported*/
+CORE_NORETURN void diag_bail(Diagnostics * d) {
+    if(d->bail) longjmp(*d->bail, 1);
+    core_exit(1);
+}
+
+CORE_NORETURN void diag_fatal(Diagnostics * d, SrcLoc loc, const char * msg) {
+    diag_report(d, loc, msg);
+    diag_bail(d);
+}
+
+/**** STRING POOL ****/
+
+/*Interned copies of token spellings, for input that does not stay in memory*/
+typedef struct {
+    core_Hashmap(Str) map;
+    core_Vec(char) scratch;
+} StrPool;
+
+Str strpool_intern(StrPool * pool, core_Arena * a, const char * ptr, unsigned int len) {
+    Str * found = core_hashmap_getn(&pool->map, ptr, len);
+    Str result;
+    if(found) return *found;
+
+    if(pool->scratch.cap < len + 1) {
+        pool->scratch.cap = len + 1;
+        pool->scratch.items = pool->scratch.items
+            ? core_arena_realloc(a, pool->scratch.items, pool->scratch.cap)
+            : core_arena_alloc(a, pool->scratch.cap);
+    }
+    memcpy(pool->scratch.items, ptr, len);
+    pool->scratch.items[len] = 0;
+    result.ptr = NULL;
+    result.len = len;
+    core_hashmap_set(&pool->map, a, pool->scratch.items, result);
+    result.ptr = pool->map.keys.items[pool->map.keys.len - 1];
+    pool->map.values.items[pool->map.values.len - 1] = result;
+    return result;
+}
+
+/**** INPUT STREAM ****/
+
+#define STREAM_BLOCK (64 * 1024)
+
+/*Sliding window over a file descriptor. Bytes before the oldest token
+  still being lexed are dropped whenever more input is read*/
+typedef struct {
+    int fd;
+    unsigned int file; /*SourceManager index*/
+    char * buf;
+    size_t cap;
+    size_t len;
+    unsigned int consumed; /*file offset of buf[0]*/
+    core_Bool eof;
+} InputStream;
+
+/**** LEXER ****/
+
+typedef struct {
+    SrcLoc loc;
+    const char * msg;
+    char ch; /*offending character, 0 if none*/
+} LexError;
+
+typedef core_Vec(LexError) LexErrors;
+
+
+typedef struct {
+    SourceManager * sm;
+    const char * begin; /*whole source file, or the stream window*/
+    const char * cur;
+    const char * end;
+    SrcLoc base; /*location of begin*/
+
+    /*only set for streamed input, tokens then get their text from the pool*/
+    InputStream * stream;
+    StrPool * pool;
+    core_Arena * arena;
+
+    /*set when lexing one chunk of a file in parallel, see tokenize_file_parallel*/
+    LexErrors * errors; /*errors are recorded here instead of printed*/
+    core_Bool chunked; /*end is not the end of the file*/
+    core_Bool open_at_end; /*a token (a comment) runs past end*/
+    SrcLoc open_loc; /*where that comment starts*/
+
+    unsigned char flags; /*TOKEN_ flags gathered for the next token*/
+} Lexer;
+
+void lexer_init(Lexer * l, SourceManager * sm, unsigned int file) {
+    const SourceFile * f = &sm->files.items[file];
+    memset(l, 0, sizeof(*l));
+    l->sm = sm;
+    l->begin = f->buf;
+    l->cur = f->buf;
+    l->end = f->buf + f->len;
+    l->base = f->base;
+    l->flags = TOKEN_BOL;
+}
+
+void lexer_init_stream(Lexer * l, SourceManager * sm, core_Arena * a, int fd, const char * name) {
+    InputStream * in = core_arena_alloc(a, sizeof(InputStream));
+    StrPool * pool = core_arena_alloc(a, sizeof(StrPool));
+    memset(in, 0, sizeof(*in));
+    memset(pool, 0, sizeof(*pool));
+    in->fd = fd;
+    in->file = srcmgr_add_stream(sm, name);
+    in->cap = 4 * STREAM_BLOCK;
+    in->buf = core_arena_alloc(a, in->cap);
+
+    memset(l, 0, sizeof(*l));
+    l->sm = sm;
+    l->begin = in->buf;
+    l->cur = in->buf;
+    l->end = in->buf;
+    l->base = sm->files.items[in->file].base;
+    l->stream = in;
+    l->pool = pool;
+    l->arena = a;
+    l->flags = TOKEN_BOL;
+}
+
+#define lexer_done(l) ((l)->cur >= (l)->end && (!(l)->stream || (l)->stream->eof))
+
+void lex_error_report(Diagnostics * d, const LexError * e) {
+    char * text;
+    if(!e->ch) {
+        diag_report(d, e->loc, e->msg);
+        return;
+    }
+    text = core_arena_alloc(d->arena, strlen(e->msg) + 4);
+    sprintf(text, "%s: %c", e->msg, e->ch);
+    diag_report(d, e->loc, text);
+}
+
+void lexer_error(Lexer * l, SrcLoc loc, const char * msg, char ch) {
+    LexError e;
+    e.loc = loc;
+    e.msg = msg;
+    e.ch = ch;
+    if(l->errors) core_vec_append(l->errors, l->arena, e);
+    else lex_error_report(l->sm->diag, &e);
+}
+
+/*Converts an integer constant and picks its type following C89 3.1.3.2*/
+void lex_int_literal(Lexer * l, Token * tok) {
+    const char * p = tok->text.ptr;
+    const char * end = p + tok->text.len;
+    core_Bool is_unsigned = CORE_FALSE;
+    core_Bool is_long = CORE_FALSE;
+    unsigned int base = 10;
+
+    for(; end > p; --end) {
+        const char c = (char)(end[-1] | 0x20);
+        if(c == 'u') is_unsigned = CORE_TRUE;
+        else if(c == 'l') is_long = CORE_TRUE;
+        else break;
+    }
+    if(end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+        base = 16;
+        p += 2;
+    } else if(p[0] == '0') {
+        base = 8;
+    }
+
+    tok->value = 0;
+    switch(core_parse_digits(p, (unsigned long)(end - p), base, &tok->value)) {
+    case CORE_PARSE_OK:
+        if(tok->value > target_umax(TARGET_LONG_BITS)) lexer_error(l, tok->loc, "Integer constant is too large", 0);
+        break;
+    case CORE_PARSE_INVALID_DIGIT: lexer_error(l, tok->loc, "Invalid digit in octal constant", 0); break;
+    case CORE_PARSE_OVERFLOW: lexer_error(l, tok->loc, "Integer constant is too large", 0); break;
+    }
+
+    /*the limits are the target's, so the types agree with ast_eval_constant*/
+    if(!is_unsigned && !is_long && tok->value <= target_umax(TARGET_INT_BITS) >> 1) tok->int_type = INT_LITERAL_INT;
+    else if(!is_long && (is_unsigned || base != 10) && tok->value <= target_umax(TARGET_INT_BITS)) tok->int_type = INT_LITERAL_UNSIGNED_INT;
+    else if(!is_unsigned && tok->value <= target_umax(TARGET_LONG_BITS) >> 1) tok->int_type = INT_LITERAL_LONG;
+    else tok->int_type = INT_LITERAL_UNSIGNED_LONG;
+}
+
+/*Drops the window before `*keep`, reads at least one more block and
+  rebases `*keep` and the cursor. Returns false once the input is exhausted*/
+core_Bool lexer_refill(Lexer * l, const char ** keep) {
+    InputStream * in = l->stream;
+    size_t drop;
+    size_t total = 0;
+    core_Bool read_any;
+    long n;
+    if(!in || in->eof) return CORE_FALSE;
+    drop = (size_t)(*keep - in->buf);
+
+    memmove(in->buf, in->buf + drop, in->len - drop);
+    in->len -= drop;
+    in->consumed += (unsigned int)drop;
+
+    /*a backslash at the end of what was read may be spliced with a newline
+      that was not, so read on until the bytes end in something else*/
+    do {
+        if(in->cap - in->len - total < STREAM_BLOCK) {
+            /*a single token is larger than the window*/
+            in->cap *= 2;
+            in->buf = core_arena_realloc(l->arena, in->buf, in->cap);
+        }
+        do {
+            n = (long)read(in->fd, in->buf + in->len + total, in->cap - in->len - total);
+        } while(n < 0 && errno == EINTR);
+        if(n < 0) diag_fatal(l->sm->diag, SRCLOC_NONE, "Failed to read input stream");
+        if(n == 0) in->eof = CORE_TRUE;
+        total += (size_t)n;
+    } while(n > 0 && in->buf[in->len + total - 1] == '\\');
+    read_any = total > 0;
+    total = srcmgr_splice(l->sm, in->file, in->buf + in->len, total, in->consumed + (unsigned int)in->len);
+    srcmgr_stream_append(l->sm, in->file, in->consumed + (unsigned int)in->len, in->buf + in->len, total);
+    in->len += total;
+
+    l->begin = in->buf;
+    l->end = in->buf + in->len;
+    l->base = l->sm->files.items[in->file].base + in->consumed;
+    l->cur = in->buf;
+    *keep = in->buf;
+    return read_any;
+}
+
+#define lexer_loc(l, p) ((l)->base + (SrcLoc)((p) - (l)->begin))
+
+core_Bool lex_token(Lexer * l, Token * result) {
+    const char * p = l->cur;
+
+    for(;;) {
+        const char * start = core_scan_whitespace(p, l->end);
+        const char * accept_end = NULL;
+        int accept = DFA_NO_ACCEPT;
+        int state = DFA_START;
+
+        if(start != p) {
+            l->flags |= TOKEN_SPACE;
+            if(memchr(p, '\n', (size_t)(start - p))) l->flags |= TOKEN_BOL;
+        }
+        p = start;
 
-   src.file = core_arena_strdup(a, path);
+        if(p >= l->end) {
+            if(lexer_refill(l, &p)) continue;
+            l->cur = p;
+            return CORE_FALSE;
+        }
+
+        /*maximal munch: run until the DFA dies, then back up to the last accepting state*/
+        while(p < l->end) {
+            state = dfa_next[state][dfa_class[(unsigned char)*p]];
+            if(state == DFA_ERROR) break;
+            ++p;
+            if(dfa_fast[state] != DFA_FAST_NONE) {
+                switch(dfa_fast[state]) {
+                case DFA_FAST_IDENTIFIER: p = core_scan_identifier(p, l->end); break;
+                case DFA_FAST_XDIGITS: p = core_scan_digits(p, l->end, 16); break;
+                case DFA_FAST_DIGITS: p = core_scan_digits(p, l->end, 10); break;
+                }
+            }
+            if(dfa_accept[state] != DFA_NO_ACCEPT) {
+                accept = dfa_accept[state];
+                accept_end = p;
+            }
+        }
+
+        /*the token may continue in the next block, lex it again once it is complete*/
+        if(state != DFA_ERROR && l->stream && !l->stream->eof) {
+            p = start;
+            (void)lexer_refill(l, &p);
+            continue;
+        }
+        if(state != DFA_ERROR && l->chunked) {
+            l->open_at_end = CORE_TRUE;
+            l->open_loc = lexer_loc(l, start);
+            l->cur = l->end;
+            return CORE_FALSE;
+        }
+
+        result->loc = lexer_loc(l, start);
+
+        /*the rest of the input is inside the comment*/
+        if(state != DFA_ERROR && accept != DFA_SKIP && l->end - start > 1 && start[0] == '/' && start[1] == '*') {
+            l->cur = l->end;
+            lexer_error(l, result->loc, "Unterminated comment", 0);
+            return CORE_FALSE;
+        }
+
+        if(accept == DFA_NO_ACCEPT) {
+            l->cur = start + 1;
+            lexer_error(l, result->loc, "Invalid Token", *start);
+            return CORE_FALSE;
+        }
+
+        p = accept_end;
+        if(accept == DFA_SKIP) {
+            l->flags |= TOKEN_SPACE;
+            continue;
+        }
+
+        result->tag = (TokenTag)accept;
+        result->flags = l->flags;
+        result->text.ptr = start;
+        result->text.len = (unsigned int)(p - start);
+        result->hideset = NULL;
+        if(result->tag == TOK_INT_LITERAL) lex_int_literal(l, result);
+        if(l->pool) {
+            /*the window moves on, so keep a copy of the spelling*/
+            if(dfa_spelling[accept]) result->text.ptr = dfa_spelling[accept];
+            else result->text = strpool_intern(l->pool, l->arena, start, result->text.len);
+        }
+        l->flags = 0;
+        l->cur = p;
+        return CORE_TRUE;
+    }
+}
+
+core_Bool lexer_open(SourceManager * sm, Lexer * l, const char * path) {
+   const long file = srcmgr_load(sm, path);
+   if(file < 0) return CORE_FALSE;
+   lexer_init(l, sm, (unsigned int)file);
+   return CORE_TRUE;
+}
 
-   fp = fopen(path, "r");
-   if(!fp) {
-       fprintf(stderr, "Failed to open file: '%s'\n", path);
-       return t;
+/*Lexes the next valid token, skipping over invalid ones. Returns false at end of input*/
+core_Bool lex_next(Lexer * l, Token * result) {
+   while(!lexer_done(l)) {
+       if(lex_token(l, result)) return CORE_TRUE;
    }
+   return CORE_FALSE;
+}
+
+Tokens tokenize_file(core_Arena * a, SourceManager * sm, const char * path) {
+   Tokens t = {0};
+   Lexer l;
+   Token tok = {0};
 
-   while(!feof(fp)) {
-       Token tok = {0};
-       if(lex_token(a, fp, &tok, &src)) {
-           core_vec_append(&t, a, tok);
-       }
+   if(!lexer_open(sm, &l, path)) return t;
+   while(lex_next(&l, &tok)) {
+       core_vec_append(&t, a, tok);
    }
-   
-   fclose(fp);
    return t;
 }
 
+/**** PARALLEL LEXING ****/
+
+/*Chunks are cut after a newline that does not follow a backslash, so the
+  only token that can cross a cut is a comment. Every chunk is therefore
+  lexed for two start states: outside a comment, and inside one*/
+#define LEX_MAX_THREADS 64
+#define LEX_MIN_CHUNK (256 * 1024)
+
 typedef struct {
-    Tokens t;
-    unsigned long i;
-} TokenStream;
+    Tokens tokens;
+    LexErrors errors;
+    core_Bool ends_in_comment;
+    SrcLoc comment_loc; /*where that comment starts, SRCLOC_NONE if the run never left the one it started in*/
+    unsigned char end_flags; /*flags gathered before that comment*/
+} LexRun;
+
+typedef struct {
+    SourceManager * sm;
+    unsigned int file;
+    const char * begin;
+    const char * end;
+    core_Bool last;
+    core_Arena arena; /*per thread, freed once its tokens are copied out*/
+    LexRun normal;
+    LexRun comment; /*started inside a comment*/
+    pthread_t thread;
+    core_Bool spawned;
+} LexChunk;
 
+void lex_chunk_init_lexer(LexChunk * c, Lexer * l, LexRun * run, const char * from) {
+    lexer_init(l, c->sm, c->file);
+    l->arena = &c->arena;
+    l->cur = from;
+    l->end = c->end;
+    l->errors = &run->errors;
+    l->chunked = !c->last;
+}
 
-Token * ts_get(TokenStream * s) {
-    if(s->i > s->t.len) return NULL;
-    return &s->t.items[s->i];
+/*index of the first token at or after loc*/
+unsigned long tokens_lower_bound(const Tokens * t, SrcLoc loc) {
+    unsigned long lo = 0;
+    unsigned long hi = t->len;
+    while(lo < hi) {
+        const unsigned long mid = lo + (hi - lo) / 2;
+        if(t->items[mid].loc < loc) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
 }
 
+void * lex_chunk(void * ctx) {
+    LexChunk * c = ctx;
+    const char * p = c->begin;
+    Lexer l;
+    Token tok = {0};
 
-Token * ts_peek(TokenStream * s) {
-    unsigned long point = s->i;
-    Token * tok = ts_get(s);
-    s->i = point;
-    return tok;
+    lex_chunk_init_lexer(c, &l, &c->normal, c->begin);
+    while(lex_next(&l, &tok)) {
+        core_vec_append(&c->normal.tokens, &c->arena, tok);
+    }
+    c->normal.ends_in_comment = l.open_at_end;
+    c->normal.comment_loc = l.open_loc;
+    c->normal.end_flags = l.flags;
+
+    /*inside a comment: skip past the first close, then lex until a token
+      starts where the normal run also has one. From there both runs agree*/
+    while((p = memchr(p, '*', (size_t)(c->end - p))) != NULL && p + 1 < c->end && p[1] != '/') ++p;
+    if(!p || p + 1 >= c->end) {
+        c->comment.ends_in_comment = CORE_TRUE;
+        c->comment.comment_loc = SRCLOC_NONE;
+        return NULL;
+    }
+    lex_chunk_init_lexer(c, &l, &c->comment, p + 2);
+    l.flags = TOKEN_SPACE; /*whether the comment began its line is only known when stitching*/
+    while(lex_next(&l, &tok)) {
+        const unsigned long i = tokens_lower_bound(&c->normal.tokens, tok.loc);
+        if(i < c->normal.tokens.len && c->normal.tokens.items[i].loc == tok.loc) {
+            unsigned long j;
+            core_vec_append(&c->comment.tokens, &c->arena, tok);
+            for(j = i + 1; j < c->normal.tokens.len; ++j) {
+                core_vec_append(&c->comment.tokens, &c->arena, c->normal.tokens.items[j]);
+            }
+            for(j = 0; j < c->normal.errors.len; ++j) {
+                if(c->normal.errors.items[j].loc < tok.loc) continue;
+                core_vec_append(&c->comment.errors, &c->arena, c->normal.errors.items[j]);
+            }
+            c->comment.ends_in_comment = c->normal.ends_in_comment;
+            c->comment.comment_loc = c->normal.comment_loc;
+            c->comment.end_flags = c->normal.end_flags;
+            return NULL;
+        }
+        core_vec_append(&c->comment.tokens, &c->arena, tok);
+    }
+    c->comment.ends_in_comment = l.open_at_end;
+    c->comment.comment_loc = l.open_loc;
+    c->comment.end_flags = l.flags;
+    return NULL;
 }
 
-/**** PARSER ****/
+Tokens tokenize_file_parallel(core_Arena * a, SourceManager * sm, const char * path, unsigned int threads) {
+    Tokens t = {0};
+    LexChunk chunks[LEX_MAX_THREADS];
+    unsigned int n = 0;
+    unsigned int i;
+    unsigned long total = 0;
+    core_Bool in_comment = CORE_FALSE;
+    unsigned char comment_flags = 0; /*flags gathered before the open comment*/
+    SrcLoc comment_loc = SRCLOC_NONE; /*where the open comment starts*/
+    const SourceFile * f;
+    const char * p;
+    const char * end;
+    const long file = srcmgr_load(sm, path);
+    if(file < 0) return t;
+    f = &sm->files.items[file];
+    p = f->buf;
+    end = f->buf + f->len;
 
-typedef enum {
-    TOPLEVEL_FUNCTION_DEFINITION
-} ToplevelTag;
+    threads = CORE_MAX(1, CORE_MIN(threads, LEX_MAX_THREADS));
+    threads = CORE_MIN(threads, f->len / LEX_MIN_CHUNK + 1);
 
-typedef enum {
-    STATEMENT_RETURN
-} StatementTag;
+    while(p < end) {
+        LexChunk * c = &chunks[n++];
+        const char * cut = end;
+        if(n < threads) {
+            cut = p + (end - p) / (threads - n + 1);
+            while(cut < end && !(cut[0] == '\n' && cut[-1] != '\\')) ++cut;
+            if(cut < end) ++cut;
+        }
+        memset(c, 0, sizeof(*c));
+        c->sm = sm;
+        c->file = (unsigned int)file;
+        c->begin = p;
+        c->end = cut;
+        c->last = cut == end;
+        p = cut;
+    }
 
-typedef enum {
-    EXPRESSION_PLUS,
-    EXPRESSION_IDENTIFIER
-} ExpressionTag;
+    for(i = 1; i < n; ++i) {
+        chunks[i].spawned = pthread_create(&chunks[i].thread, NULL, lex_chunk, &chunks[i]) == 0;
+    }
+    for(i = 0; i < n; ++i) {
+        if(chunks[i].spawned) pthread_join(chunks[i].thread, NULL);
+        else (void)lex_chunk(&chunks[i]);
+    }
 
-typedef struct Expression Expression;
-struct Expression {
-    ExpressionTag tag;
-    union {
-        struct {
-            Expression * lhs;
-            Expression * rhs;
-        } plus;
-        const char * identifier;
-    } as;
-};
+    /*stitch: each chunk's real start state is the previous chunk's end state*/
+    for(i = 0; i < n; ++i) {
+        LexRun * run = in_comment ? &chunks[i].comment : &chunks[i].normal;
+        total += run->tokens.len;
+        in_comment = run->ends_in_comment;
+    }
+    t.cap = (unsigned int)total + 1;
+    t.items = core_arena_alloc(a, sizeof(Token) * t.cap);
+    in_comment = CORE_FALSE;
+    for(i = 0; i < n; ++i) {
+        LexRun * run = in_comment ? &chunks[i].comment : &chunks[i].normal;
+        unsigned long j;
+        if(run->tokens.len > 0) {
+            memcpy(&t.items[t.len], run->tokens.items, sizeof(Token) * run->tokens.len);
+            if(in_comment) t.items[t.len].flags |= comment_flags;
+        }
+        t.len += run->tokens.len;
+        for(j = 0; j < run->errors.len; ++j) {
+            lex_error_report(sm->diag, &run->errors.items[j]);
+        }
+        /*a run without tokens never left the comment it started in*/
+        if(in_comment && run->tokens.len == 0) comment_flags |= run->end_flags;
+        else comment_flags = run->end_flags;
+        if(run->ends_in_comment && run->comment_loc != SRCLOC_NONE) comment_loc = run->comment_loc;
+        in_comment = run->ends_in_comment;
+        core_arena_free(&chunks[i].arena);
+    }
+    /*the last chunk is lexed to the real end, so this is what lex_token reports there*/
+    if(in_comment) {
+        LexError e;
+        e.loc = comment_loc;
+        e.msg = "Unterminated comment";
+        e.ch = 0;
+        lex_error_report(sm->diag, &e);
+    }
+    return t;
+}
 
-typedef struct {
-    StatementTag tag;
-    union {
-        struct {
-            Expression value;
-        } return_;
-    } as;
-} Statement;
-typedef core_Vec(Statement) Statements;
+/**** PREPROCESSOR ****/
 
-typedef enum {
-    TYPE_INT
-} TypeSpecifierTag;
+/*Sits between the lexers and the TokenStream. Directives are carried out
+  as tokens are pulled, and macros are expanded with Prosser's algorithm:
+  every token carries the set of macros it came out of (its hide-set) and
+  none of those are expanded again from it*/
 
-typedef struct TypeSpecifier TypeSpecifier;
-struct TypeSpecifier {
-    TypeSpecifierTag tag;
-    /*union {} as;*/
-};
+#define PP_MAX_INCLUDE_DEPTH 200
+#define PP_MAX_PATH 4096
+
+typedef core_Vec(Str) Strs;
+typedef core_Vec(Tokens) TokenLists;
 
 typedef struct {
-    TypeSpecifier type;
-    const char * name;
-} FunctionParameter;
+    core_Symbol sym; /*index in Preprocessor.macros, which is what hide-sets hold*/
+    core_Bool defined; /*false after #undef*/
+    core_Bool function_like;
+    Strs params;
+    Tokens body;
+    SrcLoc loc;
+    const HideSet * self; /*{sym}*/
 
-typedef core_Vec(FunctionParameter) FunctionParameters;
+    /*An object-like macro used outside of any expansion always expands the
+      same way, unless its expansion ends in a function-like macro name that
+      may take its arguments from what follows. Otherwise the full expansion
+      is kept and replayed until the next #define or #undef*/
+    unsigned long memo_generation; /*Preprocessor.generation the memo was made in, 0 if never*/
+    core_Bool memo_ok;
+    Tokens memo;
+} Macro;
 
+/*An included file, keyed by its resolved path. The file is only read the
+  first time, and not even opened again once it is known to be guarded*/
 typedef struct {
-    const char * name;
-    TypeSpecifier return_type;
-    FunctionParameters parameters;
-} FunctionPrototype;
+    unsigned int file; /*SourceManager index*/
+    core_Bool once; /*#pragma once*/
+    const char * guard; /*include guard macro, found when the file was first lexed*/
+} PPFile;
+
+/*A file is guarded if it is a single #ifndef X ... #endif with nothing
+  but comments outside it, so including it again while X is defined can
+  not produce any tokens*/
+typedef enum {
+    GUARD_START,
+    GUARD_OPEN, /*inside #ifndef X*/
+    GUARD_CLOSED, /*after the matching #endif*/
+    GUARD_NONE
+} GuardState;
 
 typedef struct {
-    FunctionPrototype prototype;
-    Statements * body;
-} FunctionDefinition;
+    Lexer lexer;
+    const Tokens * tokens; /*pre-lexed input, used instead of lexer when set*/
+    unsigned long next; /*index into tokens*/
+    Token peek;
+    core_Bool has_peek;
+    long info; /*index into Preprocessor.files, -1 for the main input*/
+    unsigned int cond_base; /*conditionals already open when the file was entered*/
+    GuardState guard_state;
+    Str guard;
+} PPFrame;
 
 typedef struct {
-    ToplevelTag tag;
-    union {
-        FunctionDefinition function_definition;
-    } as;
-} Toplevel;
+    SrcLoc loc;
+    core_Bool active; /*tokens of the current group are kept*/
+    core_Bool taken; /*no later group may be kept*/
+    core_Bool seen_else;
+} PPCond;
 
-typedef core_Vec(Toplevel) Toplevels;
+typedef struct {
+    SourceManager * sm;
+    core_Arena * arena;
+    core_Vec(PPFrame) frames; /*include stack*/
+    core_Vec(PPCond) conds;
+    core_Hashmap(Macro) macros;
+    core_Hashmap(PPFile) files; /*keyed by device and inode, see pp_file_lookup*/
+    core_Vec(const char *) include_dirs;
+    Tokens pending; /*expanded tokens still to be read, the next one last*/
+    Tokens line; /*tokens of the directive being carried out*/
+    Tokens expr_in; /*#if expression with defined replaced*/
+    Tokens expr; /*and after expansion*/
+    core_Vec(char) scratch;
+    unsigned long keyword_macros; /*defined macros named like keywords, only then are keywords looked up*/
+    unsigned long generation; /*bumped by every #define and #undef*/
 
-core_Bool parse_type_specifier(TokenStream * s, core_Arena * a, TypeSpecifier * out) {
-    Token * tok = ts_get(s);
-    (void)a;
-    if(tok->tag == TOK_INT) {
-        out->tag = TYPE_INT;
-    } else {
-        CORE_TODO("Support parsing other types");
+    /*state of the innermost memoizing expansion, see pp_memoize*/
+    unsigned long markers;
+    unsigned long memo_marker;
+    core_Bool memo_escaped; /*a macro looked for arguments past the end*/
+    core_Bool memo_builtin; /*__LINE__ or __FILE__ was expanded*/
+
+    /*the last union, tokens of one argument tend to share their hide-set*/
+    const HideSet * union_lhs;
+    const HideSet * union_rhs;
+    const HideSet * union_result;
+
+    unsigned long skipped_includes;
+    unsigned long memo_hits;
+} Preprocessor;
+
+/*Keywords are names to the preprocessor. They come first in c89.lex*/
+#define token_is_name(tag) ((tag) == TOK_IDENTIFIER || (unsigned int)(tag) <= TOK_WHILE)
+
+#define pp_top_frame(pp) (&(pp)->frames.items[(pp)->frames.len - 1])
+#define pp_skipping(pp) ((pp)->conds.len > 0 && !(pp)->conds.items[(pp)->conds.len - 1].active)
+
+core_Bool pp_next(Preprocessor * pp, Token * out);
+
+void pp_error(Preprocessor * pp, SrcLoc loc, const char * msg) {
+    diag_report(pp->sm->diag, loc, msg);
+}
+
+void pp_error_str(Preprocessor * pp, SrcLoc loc, const char * msg, Str s) {
+    diag_report_str(pp->sm->diag, loc, msg, s);
+}
+
+HideSet * hideset_new(core_Arena * a, unsigned int len) {
+    HideSet * hs = core_arena_alloc(a, sizeof(HideSet) + sizeof(core_Symbol) * len);
+    hs->syms = (core_Symbol *)(hs + 1);
+    hs->len = len;
+    return hs;
+}
+
+core_Bool hideset_has(const HideSet * hs, core_Symbol sym) {
+    unsigned int lo = 0;
+    unsigned int hi;
+    if(!hs) return CORE_FALSE;
+    hi = hs->len;
+    while(lo < hi) {
+        const unsigned int mid = lo + (hi - lo) / 2;
+        if(hs->syms[mid] < sym) lo = mid + 1;
+        else hi = mid;
     }
-    return CORE_TRUE;
+    return lo < hs->len && hs->syms[lo] == sym;
+}
+
+/*Size of the merged set, counted first so no allocation is made for a set that already exists*/
+unsigned int hideset_merge_len(const HideSet * lhs, const HideSet * rhs, core_Bool intersect) {
+    unsigned int len = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    while(i < lhs->len && j < rhs->len) {
+        if(lhs->syms[i] < rhs->syms[j]) ++i;
+        else if(rhs->syms[j] < lhs->syms[i]) ++j;
+        else {
+            ++i;
+            ++j;
+            ++len;
+        }
+    }
+    return intersect ? len : lhs->len + rhs->len - len;
 }
 
-core_Bool parse_statement(TokenStream * s, core_Arena * a, Statement * out) {
-    Token * first = ts_get(s);
-    if(!first) QUIT("Expected statement");
-    
+const HideSet * hideset_union(Preprocessor * pp, const HideSet * lhs, const HideSet * rhs) {
+    HideSet * result;
+    core_Symbol * out;
+    unsigned int len;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    if(!lhs || lhs == rhs) return rhs;
+    if(!rhs) return lhs;
+    if(lhs == pp->union_lhs && rhs == pp->union_rhs) return pp->union_result;
+
+    /*a set that already holds the other is reused*/
+    len = hideset_merge_len(lhs, rhs, CORE_FALSE);
+    if(len == lhs->len) return lhs;
+    if(len == rhs->len) return rhs;
+
+    result = hideset_new(pp->arena, len);
+    out = (core_Symbol *)result->syms;
+    result->len = 0;
+    while(i < lhs->len || j < rhs->len) {
+        if(j == rhs->len || (i < lhs->len && lhs->syms[i] < rhs->syms[j])) out[result->len++] = lhs->syms[i++];
+        else if(i == lhs->len || rhs->syms[j] < lhs->syms[i]) out[result->len++] = rhs->syms[j++];
+        else {
+            out[result->len++] = lhs->syms[i++];
+            ++j;
+        }
+    }
+    pp->union_lhs = lhs;
+    pp->union_rhs = rhs;
+    pp->union_result = result;
+    return result;
 }
 
-core_Bool parse_function_definition_or_prototype(TokenStream * s, core_Arena * a, FunctionDefinition * out) {
-    Token * name = NULL;
-    Token * parens;
-    core_Bool more_parameters = CORE_TRUE;
-    if(!parse_type_specifier(s, a, &out->prototype.return_type)) return CORE_FALSE;
-    name = ts_get(s);
-    if(!name || name->tag != TOK_IDENTIFIER) CORE_FATAL_ERROR("Expected identifier");
-    out->prototype.name = core_arena_strdup(a, name->identifier);
-    parens = ts_get(s);
-    if(parens->tag != TOK_OPEN_PARENS) CORE_FATAL_ERROR("Expected '('");
-    while(more_parameters) {
-        FunctionParameter param = {0};
-        if(!parse_type_specifier(s, a, &param.type)) CORE_FATAL_ERROR("Expected type specifier");
-        name = ts_get(s);
-        if(!name || name->tag != TOK_IDENTIFIER) CORE_FATAL_ERROR("Expected identifier");
-        param.name = core_arena_strdup(a, name->identifier);
-        core_vec_append(&out->prototype.parameters, a, param);
-        if(ts_peek(s) && ts_peek(s)->tag == TOK_COMMA) 
-            more_parameters = CORE_TRUE; 
-        else more_parameters = CORE_FALSE;;
-    }
-    if(!ts_peek(s)) CORE_FATAL_ERROR("Unexpected EOF");
-    if(ts_get(s)->tag != TOK_CLOSE_PARENS) CORE_FATAL_ERROR("Expected ')'");
-
-    if(ts_peek(s) && ts_peek(s)->tag == TOK_SEMICOLON) {
-        out->body = NULL;
-        return CORE_TRUE;
+const HideSet * hideset_intersect(Preprocessor * pp, const HideSet * lhs, const HideSet * rhs) {
+    HideSet * result;
+    core_Symbol * out;
+    unsigned int len;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    if(!lhs || !rhs) return NULL;
+    if(lhs == rhs) return lhs;
+
+    len = hideset_merge_len(lhs, rhs, CORE_TRUE);
+    if(len == 0) return NULL;
+    if(len == lhs->len) return lhs;
+    if(len == rhs->len) return rhs;
+
+    result = hideset_new(pp->arena, len);
+    out = (core_Symbol *)result->syms;
+    result->len = 0;
+    while(i < lhs->len && j < rhs->len) {
+        if(lhs->syms[i] < rhs->syms[j]) ++i;
+        else if(rhs->syms[j] < lhs->syms[i]) ++j;
+        else {
+            out[result->len++] = lhs->syms[i++];
+            ++j;
+        }
     }
+    return result;
+}
 
-    if(!ts_peek(s) || ts_get(s)->tag != TOK_OPEN_BRACE) CORE_FATAL_ERROR("Expected '{'");
-    
-    
+Macro * pp_lookup(Preprocessor * pp, const Token * tok) {
+    Macro * m;
+    if(tok->tag != TOK_IDENTIFIER && (pp->keyword_macros == 0 || !token_is_name(tok->tag))) return NULL;
+    m = core_hashmap_getn(&pp->macros, tok->text.ptr, tok->text.len);
+    return m && m->defined ? m : NULL;
 }
 
-core_Bool parser_should_parse_declaration(TokenStream * s) {
-    /*TODO: make this function more robust*/
-    
-    Token * tok = ts_peek(s);
-    assert(tok);
-    if(tok->tag == TOK_INT) return CORE_TRUE;
-    return CORE_FALSE;
+core_Bool pp_defined(Preprocessor * pp, Str name) {
+    const Macro * m = core_hashmap_getn(&pp->macros, name.ptr, name.len);
+    return m && m->defined;
 }
 
-core_Bool parse_declaration(TokenStream * s, core_Arena * a, Toplevel * out) {
-    long save_point = s->i;
-    TypeSpecifier type = {0};
-    if(!parse_type_specifier(s, a, &type)) QUIT("Failed to parse declaration type");
-    Token * name = ts_get(s);
-    Token * third = ts_get(s);
-    if(third->tag == TOK_OPEN_PARENS) {
-        s->i = save_point;
-        
+long pp_param_index(const Macro * m, const Token * tok) {
+    unsigned int i;
+    if(!m->function_like || !token_is_name(tok->tag)) return -1;
+    for(i = 0; i < m->params.len; ++i) {
+        if(str_eq(m->params.items[i], tok->text)) return (long)i;
     }
+    return -1;
 }
 
-core_Bool parse_toplevel(TokenStream * s, core_Arena * a, Toplevel * out) {
-    if(parser_should_parse_declaration(s)) {
-        return parse_declaration(s, a, out);
-    } else {
-        CORE_TODO("Parse other toplevel forms");
+/**** PREPROCESSOR: EXPANSION ****/
+
+/*Pushes tokens so they are read next, in order*/
+void pp_unread(Preprocessor * pp, const Token * toks, unsigned int n) {
+    while(n-- > 0) core_vec_append(&pp->pending, pp->arena, toks[n]);
+}
+
+/*Next token with directives carried out and skipped groups dropped, but
+  before macro expansion*/
+core_Bool pp_read(Preprocessor * pp, Token * out);
+
+/*Fully expands toks on their own, as macro arguments and #if lines are.
+  A TOK_EOF marker below them keeps reads from running into what follows,
+  its value tells a memoizing expansion apart*/
+void pp_expand_marked(Preprocessor * pp, const Token * toks, unsigned int n, Tokens * out, unsigned long marker_id) {
+    Token marker;
+    memset(&marker, 0, sizeof(marker));
+    marker.tag = TOK_EOF;
+    marker.value = marker_id;
+    core_vec_append(&pp->pending, pp->arena, marker);
+    pp_unread(pp, toks, n);
+    for(;;) {
+        Token t;
+        if(!pp_next(pp, &t) || t.tag == TOK_EOF) break;
+        core_vec_append(out, pp->arena, t);
     }
-    return CORE_TRUE;
 }
 
-int main(void) {
-    unsigned long i = 0;
-    core_Arena a = {0};
-    Tokens t = tokenize_file(&a, "test-cases/001.c");
-    for(i = 0; i < t.len; ++i) {
-        token_print(t.items[i]);
-        puts("");
+#define pp_expand_list(pp, toks, n, out) pp_expand_marked(pp, toks, n, out, 0)
+
+/*True for the marker of the innermost memoizing expansion*/
+#define pp_is_memo_marker(pp, t) ((t)->tag == TOK_EOF && (t)->value != 0 && (t)->value == (pp)->memo_marker)
+
+Token pp_stringize(Preprocessor * pp, const Tokens * arg, SrcLoc loc) {
+    Token t;
+    unsigned int i, j;
+    pp->scratch.len = 0;
+    core_vec_append(&pp->scratch, pp->arena, '"');
+    for(i = 0; i < arg->len; ++i) {
+        const Token * a = &arg->items[i];
+        const core_Bool escape = a->tag == TOK_STRING_LITERAL || a->tag == TOK_CHAR_LITERAL;
+        if(i > 0 && (a->flags & TOKEN_SPACE)) core_vec_append(&pp->scratch, pp->arena, ' ');
+        for(j = 0; j < a->text.len; ++j) {
+            const char c = a->text.ptr[j];
+            if(escape && (c == '"' || c == '\\')) core_vec_append(&pp->scratch, pp->arena, '\\');
+            core_vec_append(&pp->scratch, pp->arena, c);
+        }
+    }
+    core_vec_append(&pp->scratch, pp->arena, '"');
+
+    memset(&t, 0, sizeof(t));
+    t.tag = TOK_STRING_LITERAL;
+    t.text.ptr = core_arena_strndup(pp->arena, pp->scratch.items, pp->scratch.len);
+    t.text.len = pp->scratch.len;
+    t.loc = loc;
+    return t;
+}
+
+/*Pastes rhs onto the end of lhs. The result has to lex as a single token,
+  otherwise both are kept as they are*/
+void pp_glue(Preprocessor * pp, Tokens * out, const Token * rhs) {
+    Token * lhs = &out->items[out->len - 1];
+    const unsigned int len = lhs->text.len + rhs->text.len;
+    char * buf = core_arena_alloc(pp->arena, len + 1);
+    LexErrors errors = {0};
+    Lexer l;
+    Token t;
+    Str pasted;
+
+    memcpy(buf, lhs->text.ptr, lhs->text.len);
+    memcpy(buf + lhs->text.len, rhs->text.ptr, rhs->text.len);
+    buf[len] = 0;
+    memset(&l, 0, sizeof(l));
+    l.sm = pp->sm;
+    l.begin = buf;
+    l.cur = buf;
+    l.end = buf + len;
+    l.base = lhs->loc;
+    l.errors = &errors;
+    l.arena = pp->arena;
+
+    if(lex_token(&l, &t) && l.cur == l.end && errors.len == 0) {
+        t.flags = lhs->flags;
+        t.hideset = hideset_intersect(pp, lhs->hideset, rhs->hideset);
+        t.loc = lhs->loc;
+        *lhs = t;
+        return;
     }
+    pasted.ptr = buf;
+    pasted.len = len;
+    pp_error_str(pp, lhs->loc, "Pasting does not give a valid preprocessing token", pasted);
+    core_vec_append(out, pp->arena, *rhs);
+}
 
-    core_arena_free(&a);
-    
+/*Replaces the body of m for one invocation. Parameters are replaced by
+  their fully expanded argument, except next to # and ##, and every
+  resulting token has hs added to its hide-set*/
+void pp_subst(Preprocessor * pp, const Macro * m, const TokenLists * args, const HideSet * hs, const Token * name, Tokens * out) {
+    unsigned int i;
+    core_Bool placemarker = CORE_FALSE; /*an empty argument was just substituted*/
+    for(i = 0; i < m->body.len; ++i) {
+        const Token * b = &m->body.items[i];
+        const long param = args ? pp_param_index(m, b) : -1;
+        Token t;
+
+        if(args && b->tag == TOK_HASH && i + 1 < m->body.len) {
+            const long j = pp_param_index(m, &m->body.items[i + 1]);
+            if(j >= 0) {
+                t = pp_stringize(pp, &args->items[j], name->loc);
+                t.flags = b->flags;
+                core_vec_append(out, pp->arena, t);
+                placemarker = CORE_FALSE;
+                ++i;
+                continue;
+            }
+        }
+        if(b->tag == TOK_HASH_HASH && i + 1 < m->body.len) {
+            const Token * rhs = &m->body.items[++i];
+            const long j = args ? pp_param_index(m, rhs) : -1;
+            const Token * first = rhs;
+            unsigned int count = 1;
+            if(j >= 0) {
+                first = args->items[j].items;
+                count = args->items[j].len;
+            }
+            if(count == 0) continue;
+            if(placemarker) core_vec_append(out, pp->arena, first[0]);
+            else pp_glue(pp, out, &first[0]);
+            if(j < 0) out->items[out->len - 1].loc = name->loc;
+            while(--count > 0) core_vec_append(out, pp->arena, *++first);
+            placemarker = CORE_FALSE;
+            continue;
+        }
+        if(param >= 0) {
+            const Tokens * arg = &args->items[param];
+            const unsigned int start = out->len;
+            if(i + 1 < m->body.len && m->body.items[i + 1].tag == TOK_HASH_HASH) {
+                unsigned int k;
+                for(k = 0; k < arg->len; ++k) core_vec_append(out, pp->arena, arg->items[k]);
+            } else {
+                pp_expand_list(pp, arg->items, arg->len, out);
+            }
+            if(out->len > start) out->items[start].flags = b->flags;
+            placemarker = out->len == start;
+            continue;
+        }
+        t = *b;
+        t.loc = name->loc;
+        core_vec_append(out, pp->arena, t);
+        placemarker = CORE_FALSE;
+    }
+
+    for(i = 0; i < out->len; ++i) {
+        Token * t = &out->items[i];
+        t->hideset = hideset_union(pp, t->hideset, hs);
+        t->flags &= (unsigned char)~TOKEN_BOL;
+    }
+    if(out->len > 0) {
+        out->items[0].flags = (unsigned char)((out->items[0].flags & ~TOKEN_SPACE) | (name->flags & TOKEN_SPACE));
+    }
+}
+
+/*Reads the arguments of a function-like invocation up to the closing parenthesis*/
+core_Bool pp_collect_args(Preprocessor * pp, const Macro * m, const Token * name, TokenLists * args, Token * close) {
+    Tokens arg = {0};
+    unsigned int depth = 0;
+    for(;;) {
+        Token t;
+        if(!pp_read(pp, &t)) {
+            pp_error_str(pp, name->loc, "Unterminated invocation of macro", name->text);
+            return CORE_FALSE;
+        }
+        if(t.tag == TOK_EOF) {
+            pp_unread(pp, &t, 1);
+            /*when memoizing, the arguments may still follow in place*/
+            if(pp_is_memo_marker(pp, &t)) pp->memo_escaped = CORE_TRUE;
+            else pp_error_str(pp, name->loc, "Unterminated invocation of macro", name->text);
+            return CORE_FALSE;
+        }
+        if(depth == 0 && (t.tag == TOK_COMMA || t.tag == TOK_CLOSE_PARENS)) {
+            core_vec_append(args, pp->arena, arg);
+            memset(&arg, 0, sizeof(arg));
+            if(t.tag == TOK_CLOSE_PARENS) {
+                *close = t;
+                break;
+            }
+            continue;
+        }
+        if(t.tag == TOK_OPEN_PARENS) ++depth;
+        else if(t.tag == TOK_CLOSE_PARENS) --depth;
+        core_vec_append(&arg, pp->arena, t);
+    }
+    /*F() passes one empty argument, which is none at all when F takes none*/
+    if(m->params.len == 0 && args->len == 1 && args->items[0].len == 0) args->len = 0;
+    if(args->len != m->params.len) {
+        pp_error_str(pp, name->loc, "Wrong number of arguments for macro", name->text);
+        return CORE_FALSE;
+    }
+    return CORE_TRUE;
+}
+
+/*Pushes the expansion of the invocation starting at name. Returns false if
+  a function-like macro is not followed by '(' and so is not invoked*/
+core_Bool pp_expand(Preprocessor * pp, const Macro * m, const Token * name) {
+    Tokens out = {0};
+    if(!m->function_like) {
+        pp_subst(pp, m, NULL, hideset_union(pp, name->hideset, m->self), name, &out);
+    } else {
+        TokenLists args = {0};
+        Token t;
+        Token close;
+        if(!pp_read(pp, &t)) return CORE_FALSE;
+        if(t.tag != TOK_OPEN_PARENS) {
+            if(pp_is_memo_marker(pp, &t)) pp->memo_escaped = CORE_TRUE;
+            pp_unread(pp, &t, 1);
+            return CORE_FALSE;
+        }
+        if(!pp_collect_args(pp, m, name, &args, &close)) return CORE_TRUE;
+        pp_subst(pp, m, &args, hideset_union(pp, hideset_intersect(pp, name->hideset, close.hideset), m->self), name, &out);
+    }
+    pp_unread(pp, out.items, out.len);
+    return CORE_TRUE;
+}
+
+/*__LINE__ and __FILE__ depend on where they are used*/
+void pp_builtin(Preprocessor * pp, Token * tok) {
+    char buf[32];
+    if(core_slice_streql(tok->text, "__LINE__") || core_slice_streql(tok->text, "__FILE__")) pp->memo_builtin = CORE_TRUE;
+    if(core_slice_streql(tok->text, "__LINE__")) {
+        const SrcInfo info = srcmgr_resolve(pp->sm, tok->loc);
+        sprintf(buf, "%ld", info.line);
+        tok->tag = TOK_INT_LITERAL;
+        tok->text.ptr = core_arena_strdup(pp->arena, buf);
+        tok->text.len = (unsigned int)strlen(buf);
+        tok->value = (unsigned long)info.line;
+        tok->int_type = INT_LITERAL_INT;
+    } else if(core_slice_streql(tok->text, "__FILE__")) {
+        const char * path = srcmgr_file(pp->sm, tok->loc)->path;
+        const size_t len = strlen(path);
+        char * text = core_arena_alloc(pp->arena, len + 3);
+        text[0] = '"';
+        memcpy(text + 1, path, len);
+        text[len + 1] = '"';
+        text[len + 2] = 0;
+        tok->tag = TOK_STRING_LITERAL;
+        tok->text.ptr = text;
+        tok->text.len = (unsigned int)len + 2;
+    }
+}
+
+/*Expands the object-like macro sym on its own to find out whether the
+  result can be replayed*/
+void pp_memoize(Preprocessor * pp, core_Symbol sym, const Token * name) {
+    const unsigned long outer_marker = pp->memo_marker;
+    const core_Bool outer_escaped = pp->memo_escaped;
+    const core_Bool outer_builtin = pp->memo_builtin;
+    Macro * m = &pp->macros.values.items[sym];
+    Tokens out = {0};
+
+    /*uses while the memo is being made are expanded in place*/
+    m->memo_generation = pp->generation;
+    m->memo_ok = CORE_FALSE;
+    pp->memo_marker = ++pp->markers;
+    pp->memo_escaped = CORE_FALSE;
+    pp->memo_builtin = CORE_FALSE;
+    pp_expand_marked(pp, name, 1, &out, pp->memo_marker);
+
+    m = &pp->macros.values.items[sym];
+    m->memo_ok = !pp->memo_escaped && !pp->memo_builtin;
+    if(m->memo_ok) m->memo = out;
+    pp->memo_marker = outer_marker;
+    pp->memo_escaped = outer_escaped;
+    pp->memo_builtin = outer_builtin;
+}
+
+/*Pushes the memoized expansion of an object-like macro used outside of
+  any expansion. Returns false if it has to be expanded in place*/
+core_Bool pp_replay(Preprocessor * pp, core_Symbol sym, const Token * name) {
+    const Macro * m = &pp->macros.values.items[sym];
+    unsigned int i;
+    if(m->memo_generation != pp->generation) {
+        pp_memoize(pp, sym, name);
+        m = &pp->macros.values.items[sym];
+    }
+    if(!m->memo_ok) return CORE_FALSE;
+    for(i = m->memo.len; i-- > 0;) {
+        Token t = m->memo.items[i];
+        t.loc = name->loc; /*as the tokens of an expansion are placed at the invocation*/
+        t.flags |= TOKEN_NO_EXPAND;
+        if(i == 0) t.flags = (unsigned char)((t.flags & ~TOKEN_SPACE) | (name->flags & TOKEN_SPACE));
+        core_vec_append(&pp->pending, pp->arena, t);
+    }
+    ++pp->memo_hits;
+    return CORE_TRUE;
+}
+
+core_Bool pp_next(Preprocessor * pp, Token * out) {
+    for(;;) {
+        Macro * found;
+        Macro m;
+        if(!pp_read(pp, out)) return CORE_FALSE;
+        if(out->flags & TOKEN_NO_EXPAND) return CORE_TRUE;
+        found = pp_lookup(pp, out);
+        if(!found) {
+            if(out->tag == TOK_IDENTIFIER && out->text.len == 8 && out->text.ptr[0] == '_') pp_builtin(pp, out);
+            return CORE_TRUE;
+        }
+        if(hideset_has(out->hideset, found->sym)) return CORE_TRUE;
+        if(!found->function_like && !out->hideset && pp_replay(pp, found->sym, out)) continue;
+        m = *found; /*reading the arguments may carry out a #define*/
+        if(!pp_expand(pp, &m, out)) return CORE_TRUE;
+    }
+}
+
+/**** CONSTANT ARITHMETIC ****/
+
+/*Integer arithmetic done the way the target does it, for #if and for the
+  constant expressions of the tree. A value is held in an unsigned long
+  wrapped to the width of its type and sign extended if the type is
+  signed, so comparing two of the same type is comparing the host values*/
+
+typedef struct {
+    unsigned long value;
+    unsigned int bits;
+    core_Bool is_unsigned;
+} ConstValue;
+
+typedef enum {
+    CONST_OK,
+    CONST_DIVISION_BY_ZERO, /*the value is 0*/
+    CONST_NOT_CONSTANT
+} ConstStatus;
+
+ConstValue const_make(unsigned long value, unsigned int bits, core_Bool is_unsigned) {
+    ConstValue v;
+    if(bits < sizeof(unsigned long) * CHAR_BIT) {
+        const unsigned long mask = (1UL << bits) - 1;
+        value &= mask;
+        if(!is_unsigned && (value >> (bits - 1)) & 1) value |= ~mask;
+    }
+    v.value = value;
+    v.bits = bits;
+    v.is_unsigned = is_unsigned;
+    return v;
+}
+
+#define const_int(value) const_make(value, TARGET_INT_BITS, CORE_FALSE)
+
+/*The integer promotions, what is narrower than int becomes an int*/
+ConstValue const_promote(ConstValue v) {
+    return v.bits < TARGET_INT_BITS ? const_int(v.value) : v;
+}
+
+/*The usual arithmetic conversions of two promoted values: the wider type
+  wins, and of two as wide the unsigned one*/
+void const_convert_common(ConstValue * lhs, ConstValue * rhs) {
+    const unsigned int bits = CORE_MAX(lhs->bits, rhs->bits);
+    core_Bool is_unsigned;
+    if(lhs->is_unsigned == rhs->is_unsigned) is_unsigned = lhs->is_unsigned;
+    else is_unsigned = (lhs->is_unsigned ? lhs->bits : rhs->bits) == bits;
+    *lhs = const_make(lhs->value, bits, is_unsigned);
+    *rhs = const_make(rhs->value, bits, is_unsigned);
+}
+
+/*+ - ~ and !*/
+ConstValue const_unary(TokenTag op, ConstValue v) {
+    v = const_promote(v);
+    switch(op) {
+    case TOK_MINUS: return const_make(0 - v.value, v.bits, v.is_unsigned);
+    case TOK_TILDE: return const_make(~v.value, v.bits, v.is_unsigned);
+    case TOK_BANG: return const_int(!v.value);
+    default: return v;
+    }
+}
+
+/*Every binary operator but the comma, which is not allowed in a constant
+  expression. Overflow wraps, shifts by the width or more give what the
+  host gives for the full width*/
+ConstStatus const_binary(TokenTag op, ConstValue lhs, ConstValue rhs, ConstValue * out) {
+    const unsigned long host_bits = sizeof(unsigned long) * CHAR_BIT;
+    long a, b;
+    lhs = const_promote(lhs);
+    rhs = const_promote(rhs);
+    switch(op) {
+    case TOK_AND_AND:
+        *out = const_int(lhs.value && rhs.value);
+        return CONST_OK;
+    case TOK_OR_OR:
+        *out = const_int(lhs.value || rhs.value);
+        return CONST_OK;
+    case TOK_SHL:
+        *out = const_make(rhs.value >= host_bits ? 0 : lhs.value << rhs.value, lhs.bits, lhs.is_unsigned);
+        return CONST_OK;
+    case TOK_SHR:
+        a = (long)lhs.value;
+        if(lhs.is_unsigned) *out = const_make(rhs.value >= host_bits ? 0 : lhs.value >> rhs.value, lhs.bits, CORE_TRUE);
+        else *out = const_make((unsigned long)(rhs.value >= host_bits ? (a < 0 ? -1 : 0) : a >> rhs.value), lhs.bits, CORE_FALSE);
+        return CONST_OK;
+    default:
+        break;
+    }
+    const_convert_common(&lhs, &rhs);
+    a = (long)lhs.value;
+    b = (long)rhs.value;
+    *out = const_make(0, lhs.bits, lhs.is_unsigned);
+    switch(op) {
+    case TOK_STAR: *out = const_make(lhs.value * rhs.value, lhs.bits, lhs.is_unsigned); break;
+    case TOK_SLASH:
+    case TOK_PERCENT:
+        if(rhs.value == 0) return CONST_DIVISION_BY_ZERO;
+        if(lhs.is_unsigned) *out = const_make(op == TOK_SLASH ? lhs.value / rhs.value : lhs.value % rhs.value, lhs.bits, CORE_TRUE);
+        else if(a == LONG_MIN && b == -1) *out = const_make(op == TOK_SLASH ? lhs.value : 0, lhs.bits, CORE_FALSE);
+        else *out = const_make((unsigned long)(op == TOK_SLASH ? a / b : a % b), lhs.bits, CORE_FALSE);
+        break;
+    case TOK_PLUS: *out = const_make(lhs.value + rhs.value, lhs.bits, lhs.is_unsigned); break;
+    case TOK_MINUS: *out = const_make(lhs.value - rhs.value, lhs.bits, lhs.is_unsigned); break;
+    case TOK_LT: *out = const_int(lhs.is_unsigned ? lhs.value < rhs.value : a < b); break;
+    case TOK_GT: *out = const_int(lhs.is_unsigned ? lhs.value > rhs.value : a > b); break;
+    case TOK_LE: *out = const_int(lhs.is_unsigned ? lhs.value <= rhs.value : a <= b); break;
+    case TOK_GE: *out = const_int(lhs.is_unsigned ? lhs.value >= rhs.value : a >= b); break;
+    case TOK_EQ_EQ: *out = const_int(lhs.value == rhs.value); break;
+    case TOK_NOT_EQ: *out = const_int(lhs.value != rhs.value); break;
+    case TOK_AMPERSAND: *out = const_make(lhs.value & rhs.value, lhs.bits, lhs.is_unsigned); break;
+    case TOK_CARET: *out = const_make(lhs.value ^ rhs.value, lhs.bits, lhs.is_unsigned); break;
+    case TOK_PIPE: *out = const_make(lhs.value | rhs.value, lhs.bits, lhs.is_unsigned); break;
+    default: CORE_UNREACHABLE;
+    }
+    return CONST_OK;
+}
+
+/**** PREPROCESSOR: #if ****/
+
+typedef struct {
+    Preprocessor * pp;
+    const Token * toks;
+    unsigned int len;
+    unsigned int i;
+    SrcLoc loc; /*of the directive*/
+    unsigned int dead; /*inside an operand that is not evaluated*/
+    core_Bool failed;
+} PPEval;
+
+int hex_digit_value(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*Value of a character constant. Multi-character constants pack their
+  characters into one value, and a single plain char is signed*/
+unsigned long char_literal_value(Str text) {
+    const char * p = text.ptr;
+    const char * end = text.ptr + text.len - 1; /*closing quote*/
+    const core_Bool wide = *p == 'L';
+    unsigned long value = 0;
+    unsigned int count = 0;
+    p += wide ? 2 : 1;
+    while(p < end) {
+        unsigned long c = (unsigned char)*p++;
+        if(c == '\\' && p < end) {
+            c = (unsigned char)*p++;
+            switch(c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'v': c = '\v'; break;
+            case 'f': c = '\f'; break;
+            case 'b': c = '\b'; break;
+            case 'a': c = 7; break;
+            case 'x':
+                c = 0;
+                while(p < end && hex_digit_value(*p) >= 0) c = c * 16 + (unsigned long)hex_digit_value(*p++);
+                break;
+            default:
+                if(c >= '0' && c <= '7') {
+                    unsigned int digits = 1;
+                    c -= '0';
+                    for(; digits < 3 && p < end && *p >= '0' && *p <= '7'; ++digits) c = c * 8 + (unsigned long)(*p++ - '0');
+                }
+                break;
+            }
+        }
+        value = (value << 8) | (c & 0xFF);
+        ++count;
+    }
+    if(count == 1 && !wide) value = (unsigned long)(long)(signed char)value;
+    return value;
+}
+
+void pp_eval_fail(PPEval * e, SrcLoc loc, const char * msg) {
+    if(!e->failed) pp_error(e->pp, loc, msg);
+    e->failed = CORE_TRUE;
+}
+
+#define pp_eval_loc(e) ((e)->i < (e)->len ? (e)->toks[(e)->i].loc : (e)->loc)
+
+/*In #if every integer is a long or unsigned long*/
+#define pp_long(value, is_unsigned) const_make(value, TARGET_LONG_BITS, is_unsigned)
+
+ConstValue pp_eval_conditional(PPEval * e);
+
+ConstValue pp_eval_unary(PPEval * e) {
+    ConstValue v = pp_long(0, CORE_FALSE);
+    const Token * t;
+    if(e->i >= e->len) {
+        pp_eval_fail(e, e->loc, "Expected expression in #if");
+        return v;
+    }
+    t = &e->toks[e->i++];
+    switch(t->tag) {
+    case TOK_INT_LITERAL:
+        return pp_long(t->value, t->value > LONG_MAX || memchr(t->text.ptr, 'u', t->text.len) || memchr(t->text.ptr, 'U', t->text.len));
+    case TOK_CHAR_LITERAL:
+        return pp_long(char_literal_value(t->text), CORE_FALSE);
+    case TOK_PLUS:
+    case TOK_MINUS:
+    case TOK_TILDE:
+    case TOK_BANG:
+        v = pp_eval_unary(e);
+        v = const_unary(t->tag, v);
+        return pp_long(v.value, v.is_unsigned);
+    case TOK_OPEN_PARENS:
+        v = pp_eval_conditional(e);
+        if(e->i >= e->len || e->toks[e->i].tag != TOK_CLOSE_PARENS) pp_eval_fail(e, pp_eval_loc(e), "Expected ')' in #if");
+        else ++e->i;
+        return v;
+    default:
+        /*names left over after expansion are 0*/
+        if(!token_is_name(t->tag)) pp_eval_fail(e, t->loc, "Invalid token in #if");
+        return v;
+    }
+}
+
+int pp_binary_precedence(TokenTag tag) {
+    switch(tag) {
+    case TOK_STAR: case TOK_SLASH: case TOK_PERCENT: return 10;
+    case TOK_PLUS: case TOK_MINUS: return 9;
+    case TOK_SHL: case TOK_SHR: return 8;
+    case TOK_LT: case TOK_GT: case TOK_LE: case TOK_GE: return 7;
+    case TOK_EQ_EQ: case TOK_NOT_EQ: return 6;
+    case TOK_AMPERSAND: return 5;
+    case TOK_CARET: return 4;
+    case TOK_PIPE: return 3;
+    case TOK_AND_AND: return 2;
+    case TOK_OR_OR: return 1;
+    default: return 0;
+    }
+}
+
+ConstValue pp_eval_apply(PPEval * e, const Token * op, ConstValue lhs, ConstValue rhs) {
+    ConstValue r;
+    if(const_binary(op->tag, lhs, rhs, &r) == CONST_DIVISION_BY_ZERO && !e->dead) pp_eval_fail(e, op->loc, "Division by zero in #if");
+    return pp_long(r.value, r.is_unsigned);
+}
+
+/*Precedence climbing over the binary operators*/
+ConstValue pp_eval_binary(PPEval * e, int min_precedence) {
+    ConstValue lhs = pp_eval_unary(e);
+    while(e->i < e->len && !e->failed) {
+        const Token * op = &e->toks[e->i];
+        const int precedence = pp_binary_precedence(op->tag);
+        ConstValue rhs;
+        if(precedence == 0 || precedence < min_precedence) break;
+        ++e->i;
+        if(op->tag == TOK_AND_AND || op->tag == TOK_OR_OR) {
+            const unsigned int dead = (op->tag == TOK_AND_AND) == !lhs.value;
+            e->dead += dead;
+            rhs = pp_eval_binary(e, precedence + 1);
+            e->dead -= dead;
+            lhs = pp_eval_apply(e, op, lhs, rhs);
+            continue;
+        }
+        rhs = pp_eval_binary(e, precedence + 1);
+        lhs = pp_eval_apply(e, op, lhs, rhs);
+    }
+    return lhs;
+}
+
+ConstValue pp_eval_conditional(PPEval * e) {
+    ConstValue cond = pp_eval_binary(e, 1);
+    ConstValue lhs, rhs;
+    if(e->i >= e->len || e->toks[e->i].tag != TOK_QUESTION) return cond;
+    ++e->i;
+    e->dead += !cond.value;
+    lhs = pp_eval_conditional(e);
+    e->dead -= !cond.value;
+    if(e->i >= e->len || e->toks[e->i].tag != TOK_COLON) {
+        pp_eval_fail(e, pp_eval_loc(e), "Expected ':' in #if");
+        return cond;
+    }
+    ++e->i;
+    e->dead += cond.value != 0;
+    rhs = pp_eval_conditional(e);
+    e->dead -= cond.value != 0;
+    const_convert_common(&lhs, &rhs);
+    return cond.value ? lhs : rhs;
+}
+
+/*Evaluates the tokens of an #if or #elif line*/
+core_Bool pp_eval(Preprocessor * pp, SrcLoc loc, const Token * toks, unsigned int n) {
+    Tokens * in = &pp->expr_in;
+    PPEval e;
+    ConstValue v;
+    unsigned int i;
+
+    /*defined X and defined(X) are replaced before expansion*/
+    in->len = 0;
+    for(i = 0; i < n; ++i) {
+        Token t = toks[i];
+        if(t.tag == TOK_IDENTIFIER && core_slice_streql(t.text, "defined")) {
+            const core_Bool parens = i + 1 < n && toks[i + 1].tag == TOK_OPEN_PARENS;
+            const unsigned int at = i + (parens ? 2 : 1);
+            if(at >= n || !token_is_name(toks[at].tag) || (parens && (at + 1 >= n || toks[at + 1].tag != TOK_CLOSE_PARENS))) {
+                pp_error(pp, t.loc, "Expected macro name after 'defined'");
+                return CORE_FALSE;
+            }
+            t.tag = TOK_INT_LITERAL;
+            t.value = pp_defined(pp, toks[at].text);
+            t.text.ptr = t.value ? "1" : "0";
+            t.text.len = 1;
+            i = at + (parens ? 1 : 0);
+        }
+        core_vec_append(in, pp->arena, t);
+    }
+    pp->expr.len = 0;
+    pp_expand_list(pp, in->items, in->len, &pp->expr);
+
+    memset(&e, 0, sizeof(e));
+    e.pp = pp;
+    e.toks = pp->expr.items;
+    e.len = pp->expr.len;
+    e.loc = loc;
+    v = pp_eval_conditional(&e);
+    if(!e.failed && e.i < e.len) pp_eval_fail(&e, e.toks[e.i].loc, "Unexpected token in #if");
+    return !e.failed && v.value != 0;
+}
+
+/**** PREPROCESSOR: DIRECTIVES ****/
+
+void pp_define(Preprocessor * pp, SrcLoc loc, const Token * toks, unsigned int n) {
+    Macro m;
+    Macro * old;
+    unsigned int i = 1;
+    memset(&m, 0, sizeof(m));
+    if(n == 0 || !token_is_name(toks[0].tag)) {
+        pp_error(pp, n > 0 ? toks[0].loc : loc, "Macro name must be an identifier");
+        return;
+    }
+    if(core_slice_streql(toks[0].text, "defined")) {
+        pp_error(pp, toks[0].loc, "'defined' cannot be used as a macro name");
+        return;
+    }
+    m.defined = CORE_TRUE;
+    m.loc = toks[0].loc;
+
+    /*only a parenthesis right after the name makes a function-like macro*/
+    if(n > 1 && toks[1].tag == TOK_OPEN_PARENS && !(toks[1].flags & TOKEN_SPACE)) {
+        m.function_like = CORE_TRUE;
+        i = 2;
+        if(i < n && toks[i].tag == TOK_CLOSE_PARENS) {
+            ++i;
+        } else for(;;) {
+            if(i >= n || !token_is_name(toks[i].tag)) {
+                pp_error(pp, i < n ? toks[i].loc : toks[0].loc, "Expected macro parameter name");
+                return;
+            }
+            if(pp_param_index(&m, &toks[i]) >= 0) {
+                pp_error_str(pp, toks[i].loc, "Duplicate macro parameter", toks[i].text);
+                return;
+            }
+            core_vec_append(&m.params, pp->arena, toks[i].text);
+            ++i;
+            if(i < n && toks[i].tag == TOK_COMMA) {
+                ++i;
+            } else if(i < n && toks[i].tag == TOK_CLOSE_PARENS) {
+                ++i;
+                break;
+            } else {
+                pp_error(pp, i < n ? toks[i].loc : toks[0].loc, "Expected ',' or ')' in macro parameter list");
+                return;
+            }
+        }
+    }
+    for(; i < n; ++i) core_vec_append(&m.body, pp->arena, toks[i]);
+
+    if(m.body.len > 0 && (m.body.items[0].tag == TOK_HASH_HASH || m.body.items[m.body.len - 1].tag == TOK_HASH_HASH)) {
+        pp_error(pp, m.loc, "'##' cannot appear at either end of a macro body");
+        return;
+    }
+    for(i = 0; m.function_like && i < m.body.len; ++i) {
+        if(m.body.items[i].tag == TOK_HASH && (i + 1 == m.body.len || pp_param_index(&m, &m.body.items[i + 1]) < 0)) {
+            pp_error(pp, m.body.items[i].loc, "'#' is not followed by a macro parameter");
+            return;
+        }
+    }
+
+    ++pp->generation;
+    old = core_hashmap_getn(&pp->macros, toks[0].text.ptr, toks[0].text.len);
+    if(old) {
+        if(!old->defined && toks[0].tag != TOK_IDENTIFIER) ++pp->keyword_macros;
+        m.sym = old->sym;
+        m.self = old->self;
+        *old = m;
+    } else {
+        const char * key = core_arena_strndup(pp->arena, toks[0].text.ptr, toks[0].text.len);
+        HideSet * self = hideset_new(pp->arena, 1);
+        if(toks[0].tag != TOK_IDENTIFIER) ++pp->keyword_macros;
+        m.sym = (core_Symbol)pp->macros.values.len;
+        *(core_Symbol *)self->syms = m.sym;
+        m.self = self;
+        core_hashmap_set(&pp->macros, pp->arena, key, m);
+        core_arena_reclaim_memory(pp->arena, (void *)key);
+    }
+}
+
+/*Defines a macro given on the command line as NAME or NAME=VALUE*/
+void pp_define_string(Preprocessor * pp, const char * definition) {
+    const size_t len = strlen(definition);
+    char * buf = core_arena_alloc(pp->arena, len + 3);
+    char * eq;
+    unsigned int file;
+    Lexer l;
+    Token t;
+    memcpy(buf, definition, len + 1);
+    eq = strchr(buf, '=');
+    if(eq) *eq = ' ';
+    else strcpy(buf + len, " 1");
+
+    file = srcmgr_add(pp->sm, "<command line>", buf, strlen(buf));
+    lexer_init(&l, pp->sm, file);
+    pp->line.len = 0;
+    while(lex_next(&l, &t)) core_vec_append(&pp->line, pp->arena, t);
+    pp_define(pp, pp->sm->files.items[file].base, pp->line.items, pp->line.len);
+}
+
+void pp_undef(Preprocessor * pp, SrcLoc loc, const Token * toks, unsigned int n) {
+    Macro * m;
+    if(n == 0 || !token_is_name(toks[0].tag)) {
+        pp_error(pp, n > 0 ? toks[0].loc : loc, "Macro name must be an identifier");
+        return;
+    }
+    m = core_hashmap_getn(&pp->macros, toks[0].text.ptr, toks[0].text.len);
+    if(!m || !m->defined) return;
+    if(toks[0].tag != TOK_IDENTIFIER) --pp->keyword_macros;
+    m->defined = CORE_FALSE;
+    ++pp->generation;
+}
+
+void pp_push_cond(Preprocessor * pp, SrcLoc loc, core_Bool value) {
+    PPCond c;
+    const core_Bool parent_active = !pp_skipping(pp);
+    c.loc = loc;
+    c.active = parent_active && value;
+    c.taken = c.active || !parent_active;
+    c.seen_else = CORE_FALSE;
+    core_vec_append(&pp->conds, pp->arena, c);
+}
+
+/*Conditionals are matched within a file*/
+PPCond * pp_top_cond(Preprocessor * pp, const PPFrame * f, SrcLoc loc, const char * directive) {
+    if(pp->conds.len <= f->cond_base) {
+        char * msg = core_arena_alloc(pp->arena, strlen(directive) + 16);
+        sprintf(msg, "#%s without #if", directive);
+        pp_error(pp, loc, msg);
+        return NULL;
+    }
+    return &pp->conds.items[pp->conds.len - 1];
+}
+
+/*Matches the guard form #if !defined X or #if !defined(X)*/
+core_Bool pp_guard_condition(const Token * toks, unsigned int n, Str * guard) {
+    if(n < 3 || toks[0].tag != TOK_BANG || toks[1].tag != TOK_IDENTIFIER || !core_slice_streql(toks[1].text, "defined")) return CORE_FALSE;
+    if(n == 3 && token_is_name(toks[2].tag)) {
+        *guard = toks[2].text;
+        return CORE_TRUE;
+    }
+    if(n == 5 && toks[2].tag == TOK_OPEN_PARENS && token_is_name(toks[3].tag) && toks[4].tag == TOK_CLOSE_PARENS) {
+        *guard = toks[3].text;
+        return CORE_TRUE;
+    }
+    return CORE_FALSE;
+}
+
+core_Bool path_append(char * dst, unsigned long cap, unsigned long * fill, const char * src, unsigned long len) {
+    if(*fill + len + 1 > cap) return CORE_FALSE;
+    memcpy(dst + *fill, src, len);
+    *fill += len;
+    dst[*fill] = 0;
+    return CORE_TRUE;
+}
+
+/*Spells out the "FILENAME" or <FILENAME> of an #include*/
+core_Bool pp_include_name(const Token * toks, unsigned int n, char * out, unsigned long cap, core_Bool * angled) {
+    unsigned long fill = 0;
+    unsigned int i;
+    out[0] = 0;
+    if(n == 0) return CORE_FALSE;
+    if(toks[0].tag == TOK_STRING_LITERAL && toks[0].text.ptr[0] == '"') {
+        *angled = CORE_FALSE;
+        return toks[0].text.len > 2 && path_append(out, cap, &fill, toks[0].text.ptr + 1, toks[0].text.len - 2);
+    }
+    if(toks[0].tag != TOK_LT) return CORE_FALSE;
+    for(i = 1; i < n && toks[i].tag != TOK_GT; ++i) {
+        if(i > 1 && (toks[i].flags & TOKEN_SPACE) && !path_append(out, cap, &fill, " ", 1)) return CORE_FALSE;
+        if(!path_append(out, cap, &fill, toks[i].text.ptr, toks[i].text.len)) return CORE_FALSE;
+    }
+    *angled = CORE_TRUE;
+    return i < n && fill > 0;
+}
+
+/*Returns the index into pp->files for path, reading the file the first
+  time it is seen. Returns -1 if there is no such file. Files are told
+  apart by device and inode rather than by path, so "a.h", "./a.h" and
+  "sub/../a.h" are one file to the guard and #pragma once checks*/
+long pp_file_lookup(Preprocessor * pp, const char * path) {
+    PPFile info;
+    struct stat st;
+    char key[64];
+    long file;
+    if(stat(path, &st) != 0) return -1;
+    sprintf(key, "%lx:%lx", (unsigned long)st.st_dev, (unsigned long)st.st_ino);
+    if(core_hashmap_get(&pp->files, key)) return (long)pp->files.index;
+    file = srcmgr_load(pp->sm, path);
+    if(file < 0) return -1;
+    memset(&info, 0, sizeof(info));
+    info.file = (unsigned int)file;
+    core_hashmap_set(&pp->files, pp->arena, key, info);
+    return (long)pp->files.values.len - 1;
+}
+
+/*"FILENAME" is looked up next to the including file first, then like <FILENAME>*/
+long pp_find_include(Preprocessor * pp, const char * name, core_Bool angled, const char * includer) {
+    char path[PP_MAX_PATH];
+    unsigned long fill = 0;
+    unsigned int i;
+    long index;
+    if(name[0] == '/') return pp_file_lookup(pp, name);
+    if(!angled) {
+        const char * slash = strrchr(includer, '/');
+        path[0] = 0;
+        if((!slash || path_append(path, sizeof(path), &fill, includer, (unsigned long)(slash - includer) + 1))
+           && path_append(path, sizeof(path), &fill, name, strlen(name))
+           && (index = pp_file_lookup(pp, path)) >= 0) {
+            return index;
+        }
+    }
+    for(i = 0; i < pp->include_dirs.len; ++i) {
+        const char * dir = pp->include_dirs.items[i];
+        fill = 0;
+        if(!path_append(path, sizeof(path), &fill, dir, strlen(dir))) continue;
+        if(!path_append(path, sizeof(path), &fill, "/", 1)) continue;
+        if(!path_append(path, sizeof(path), &fill, name, strlen(name))) continue;
+        if((index = pp_file_lookup(pp, path)) >= 0) return index;
+    }
+    return -1;
+}
+
+void pp_push_file(Preprocessor * pp, unsigned int file, long info) {
+    PPFrame f;
+    memset(&f, 0, sizeof(f));
+    lexer_init(&f.lexer, pp->sm, file);
+    f.info = info;
+    f.cond_base = pp->conds.len;
+    f.guard_state = GUARD_START;
+    core_vec_append(&pp->frames, pp->arena, f);
+}
+
+void pp_include(Preprocessor * pp, SrcLoc loc, const Token * toks, unsigned int n) {
+    char name[PP_MAX_PATH];
+    core_Bool angled = CORE_FALSE;
+    Tokens expanded = {0};
+    const PPFile * info;
+    Str guard;
+    long index;
+
+    if(n > 0 && toks[0].tag != TOK_STRING_LITERAL && toks[0].tag != TOK_LT) {
+        pp_expand_list(pp, toks, n, &expanded);
+        toks = expanded.items;
+        n = expanded.len;
+    }
+    if(!pp_include_name(toks, n, name, sizeof(name), &angled)) {
+        pp_error(pp, loc, "#include expects \"FILENAME\" or <FILENAME>");
+        return;
+    }
+    index = pp_find_include(pp, name, angled, srcmgr_file(pp->sm, loc)->path);
+    if(index < 0) {
+        Str s;
+        s.ptr = name;
+        s.len = (unsigned int)strlen(name);
+        pp_error_str(pp, loc, "Include file not found", s);
+        return;
+    }
+
+    info = &pp->files.values.items[index];
+    guard.ptr = info->guard;
+    guard.len = info->guard ? (unsigned int)strlen(info->guard) : 0;
+    if(info->once || (info->guard && pp_defined(pp, guard))) {
+        ++pp->skipped_includes;
+        return;
+    }
+    if(pp->frames.len >= PP_MAX_INCLUDE_DEPTH) {
+        pp_error(pp, loc, "#include nested too deeply");
+        return;
+    }
+    pp_push_file(pp, info->file, index);
+}
+
+/*Next raw token of one file, never crossing into the file that included it*/
+core_Bool pp_frame_lex(PPFrame * f, Token * out) {
+    if(f->has_peek) {
+        *out = f->peek;
+        f->has_peek = CORE_FALSE;
+        return CORE_TRUE;
+    }
+    if(f->tokens) {
+        if(f->next >= f->tokens->len) return CORE_FALSE;
+        *out = f->tokens->items[f->next++];
+        return CORE_TRUE;
+    }
+    return lex_next(&f->lexer, out);
+}
+
+/*Carries out the directive introduced by hash, which starts a line*/
+void pp_directive(Preprocessor * pp, const Token * hash) {
+    PPFrame * f = pp_top_frame(pp);
+    const GuardState guard = f->guard_state;
+    const core_Bool skipping = pp_skipping(pp);
+    const Token * args;
+    unsigned int n;
+    Str name;
+    PPCond * c;
+
+    /*the directive ends with the line, or the file*/
+    pp->line.len = 0;
+    for(;;) {
+        if(!f->has_peek) f->has_peek = pp_frame_lex(f, &f->peek);
+        if(!f->has_peek || (f->peek.flags & TOKEN_BOL)) break;
+        core_vec_append(&pp->line, pp->arena, f->peek);
+        f->has_peek = CORE_FALSE;
+    }
+    if(guard != GUARD_OPEN) f->guard_state = GUARD_NONE;
+    if(pp->line.len == 0) return;
+
+    name = pp->line.items[0].text;
+    args = pp->line.items + 1;
+    n = pp->line.len - 1;
+    if(!token_is_name(pp->line.items[0].tag)) {
+        if(!skipping) pp_error(pp, pp->line.items[0].loc, "Invalid preprocessing directive");
+        return;
+    }
+
+    if(core_slice_streql(name, "ifdef") || core_slice_streql(name, "ifndef")) {
+        const core_Bool want = name.len == 5;
+        core_Bool value = CORE_FALSE;
+        if(!skipping && (n == 0 || !token_is_name(args[0].tag))) {
+            pp_error(pp, hash->loc, "Expected macro name");
+        } else if(!skipping) {
+            value = pp_defined(pp, args[0].text) == want;
+            if(!want && guard == GUARD_START) {
+                f->guard_state = GUARD_OPEN;
+                f->guard = args[0].text;
+            }
+        }
+        pp_push_cond(pp, hash->loc, value);
+    } else if(core_slice_streql(name, "if")) {
+        const core_Bool value = !skipping && pp_eval(pp, hash->loc, args, n);
+        if(!skipping && guard == GUARD_START && pp_guard_condition(args, n, &f->guard)) f->guard_state = GUARD_OPEN;
+        pp_push_cond(pp, hash->loc, value);
+    } else if(core_slice_streql(name, "elif")) {
+        if(!(c = pp_top_cond(pp, f, hash->loc, "elif"))) return;
+        if(c->seen_else) pp_error(pp, hash->loc, "#elif after #else");
+        if(c->taken) {
+            c->active = CORE_FALSE;
+        } else {
+            c->active = pp_eval(pp, hash->loc, args, n);
+            c->taken = c->active;
+        }
+        if(guard == GUARD_OPEN && pp->conds.len == f->cond_base + 1) f->guard_state = GUARD_NONE;
+    } else if(core_slice_streql(name, "else")) {
+        if(!(c = pp_top_cond(pp, f, hash->loc, "else"))) return;
+        if(c->seen_else) pp_error(pp, hash->loc, "#else after #else");
+        c->seen_else = CORE_TRUE;
+        c->active = !c->taken;
+        c->taken = CORE_TRUE;
+        if(guard == GUARD_OPEN && pp->conds.len == f->cond_base + 1) f->guard_state = GUARD_NONE;
+    } else if(core_slice_streql(name, "endif")) {
+        if(!pp_top_cond(pp, f, hash->loc, "endif")) return;
+        --pp->conds.len;
+        if(guard == GUARD_OPEN && pp->conds.len == f->cond_base) f->guard_state = GUARD_CLOSED;
+    } else if(skipping) {
+        return;
+    } else if(core_slice_streql(name, "define")) {
+        pp_define(pp, hash->loc, args, n);
+    } else if(core_slice_streql(name, "undef")) {
+        pp_undef(pp, hash->loc, args, n);
+    } else if(core_slice_streql(name, "include")) {
+        pp_include(pp, hash->loc, args, n); /*f is stale from here on*/
+    } else if(core_slice_streql(name, "pragma")) {
+        if(n > 0 && core_slice_streql(args[0].text, "once") && f->info >= 0) {
+            pp->files.values.items[f->info].once = CORE_TRUE;
+        }
+    } else if(core_slice_streql(name, "error")) {
+        core_Vec(char) msg = {0};
+        unsigned int i, k;
+        for(k = 0; k < 6; ++k) core_vec_append(&msg, pp->arena, "#error"[k]);
+        for(i = 0; i < n; ++i) {
+            core_vec_append(&msg, pp->arena, ' ');
+            for(k = 0; k < args[i].text.len; ++k) core_vec_append(&msg, pp->arena, args[i].text.ptr[k]);
+        }
+        core_vec_append(&msg, pp->arena, 0);
+        pp_error(pp, hash->loc, msg.items);
+    } else if(core_slice_streql(name, "line")) {
+        /*locations always refer to the real file and line*/
+    } else {
+        pp_error_str(pp, pp->line.items[0].loc, "Invalid preprocessing directive", name);
+    }
+}
+
+void pp_pop_frame(Preprocessor * pp) {
+    const PPFrame * f = pp_top_frame(pp);
+    while(pp->conds.len > f->cond_base) {
+        pp_error(pp, pp->conds.items[pp->conds.len - 1].loc, "Unterminated conditional directive");
+        --pp->conds.len;
+    }
+    if(f->info >= 0 && f->guard_state == GUARD_CLOSED) {
+        pp->files.values.items[f->info].guard = core_arena_strndup(pp->arena, f->guard.ptr, f->guard.len);
+    }
+    --pp->frames.len;
+}
+
+core_Bool pp_read(Preprocessor * pp, Token * out) {
+    if(pp->pending.len > 0) {
+        *out = pp->pending.items[--pp->pending.len];
+        return CORE_TRUE;
+    }
+    while(pp->frames.len > 0) {
+        PPFrame * f = pp_top_frame(pp);
+        if(!pp_frame_lex(f, out)) {
+            pp_pop_frame(pp);
+            continue;
+        }
+        if(out->tag == TOK_HASH && (out->flags & TOKEN_BOL)) {
+            pp_directive(pp, out);
+            continue;
+        }
+        if(pp_skipping(pp)) continue;
+        if(f->guard_state != GUARD_OPEN) f->guard_state = GUARD_NONE;
+        return CORE_TRUE;
+    }
+    return CORE_FALSE;
+}
+
+/**** PREPROCESSOR: SETUP ****/
+
+void pp_init(Preprocessor * pp, SourceManager * sm, core_Arena * a) {
+    memset(pp, 0, sizeof(*pp));
+    pp->sm = sm;
+    pp->arena = a;
+    pp->generation = 1;
+    pp_define_string(pp, "__STDC__=1");
+}
+
+void pp_add_include_dir(Preprocessor * pp, const char * dir) {
+    core_vec_append(&pp->include_dirs, pp->arena, dir);
+}
+
+/*The main input, either lexed on demand or already tokenized*/
+void pp_push_lexer(Preprocessor * pp, const Lexer * l) {
+    PPFrame f;
+    memset(&f, 0, sizeof(f));
+    f.lexer = *l;
+    f.info = -1;
+    f.guard_state = GUARD_NONE;
+    core_vec_append(&pp->frames, pp->arena, f);
+}
+
+void pp_push_tokens(Preprocessor * pp, const Tokens * tokens) {
+    PPFrame f;
+    memset(&f, 0, sizeof(f));
+    f.tokens = tokens;
+    f.info = -1;
+    f.guard_state = GUARD_NONE;
+    core_vec_append(&pp->frames, pp->arena, f);
+}
+
+/*Tokens are pulled from the preprocessor (or straight from the lexer) on
+  demand. Only the last TS_WINDOW tokens are kept, which bounds how far
+  the parser may look ahead.
+
+  The token under the cursor is always in the window, and once the input
+  runs out every further token is a TOK_EOF sentinel. Reading the current
+  tag is a single load and advancing needs no end check, a parser loop
+  stops at the sentinel like at any other unexpected token*/
+#define TS_WINDOW 16
+#define TS_MASK (TS_WINDOW - 1)
+
+typedef struct {
+    Preprocessor * pp;
+    Lexer * lexer; /*used instead of pp when set*/
+    const Tokens * tokens; /*pre-lexed input, used instead of lexer when set*/
+    Token ring[TS_WINDOW];
+    unsigned long i; /*absolute index of the current token*/
+    unsigned long filled; /*number of tokens lexed so far, always more than i*/
+    core_Bool eof;
+    Token sentinel; /*TOK_EOF at the end of the last token*/
+} TokenStream;
+
+/*Ensures token `index` is in the window, the sentinel once the input has ended*/
+void ts_fill(TokenStream * s, unsigned long index) {
+    while(s->filled <= index) {
+        Token * slot = &s->ring[s->filled & TS_MASK];
+        if(!s->eof) {
+            if(s->tokens) {
+                s->eof = s->filled >= s->tokens->len;
+                if(!s->eof) *slot = s->tokens->items[s->filled];
+            } else {
+                s->eof = s->lexer ? !lex_next(s->lexer, slot) : !pp_next(s->pp, slot);
+            }
+            if(s->eof && s->filled > 0) {
+                const Token * last = &s->ring[(s->filled - 1) & TS_MASK];
+                s->sentinel.loc = last->loc + last->text.len;
+            }
+        }
+        if(s->eof) *slot = s->sentinel;
+        ++s->filled;
+    }
+}
+
+void ts_init_common(TokenStream * s) {
+    s->sentinel.tag = TOK_EOF;
+    ts_fill(s, 0);
+}
+
+void ts_init(TokenStream * s, Lexer * l) {
+    memset(s, 0, sizeof(*s));
+    s->lexer = l;
+    ts_init_common(s);
+}
+
+void ts_init_pp(TokenStream * s, Preprocessor * pp) {
+    memset(s, 0, sizeof(*s));
+    s->pp = pp;
+    ts_init_common(s);
+}
+
+void ts_init_tokens(TokenStream * s, const Tokens * t) {
+    memset(s, 0, sizeof(*s));
+    s->tokens = t;
+    ts_init_common(s);
+}
+
+#define ts_current(s) (&(s)->ring[(s)->i & TS_MASK])
+#define ts_tag(s) (ts_current(s)->tag)
+
+/*Returns the current token and moves past it. The cursor stays on the sentinel*/
+Token * ts_advance(TokenStream * s) {
+    Token * tok = ts_current(s);
+    if(tok->tag == TOK_EOF) return tok;
+    if(++s->i == s->filled) ts_fill(s, s->i);
+    return tok;
+}
+
+/*The token k places after the current one, k < TS_WINDOW*/
+Token * ts_peek(TokenStream * s, unsigned int k) {
+    assert(k < TS_WINDOW);
+    if(s->i + k >= s->filled) ts_fill(s, s->i + k);
+    return &s->ring[(s->i + k) & TS_MASK];
+}
+
+/*Consumes the current token if it is a `tag`, otherwise returns NULL and stays put*/
+Token * ts_expect(TokenStream * s, TokenTag tag) {
+    return ts_tag(s) == tag ? ts_advance(s) : NULL;
+}
+
+/**** PARSER ****/
+
+#define PARSE_MAX_DEPTH 1024 /*nested parentheses, operands and statements*/
+
+typedef enum {
+    TOPLEVEL_FUNCTION_DEFINITION,
+    TOPLEVEL_DECLARATION,
+    TOPLEVEL_TYPEDEF
+} ToplevelTag;
+
+/*The storage class specifiers, typedef among them as in C89 3.5.1. The
+  tree keeps static and extern, typedef makes a typedef toplevel or
+  statement, and auto and register change nothing it records*/
+typedef enum {
+    STORAGE_NONE,
+    STORAGE_STATIC,
+    STORAGE_EXTERN,
+    STORAGE_AUTO,
+    STORAGE_REGISTER,
+    STORAGE_TYPEDEF
+} StorageClass;
+
+typedef enum {
+    STATEMENT_RETURN,
+    STATEMENT_EXPRESSION,
+    STATEMENT_DECLARATION,
+    STATEMENT_COMPOUND,
+    STATEMENT_IF,
+    STATEMENT_WHILE,
+    STATEMENT_DO,
+    STATEMENT_FOR,
+    STATEMENT_SWITCH,
+    STATEMENT_CASE,
+    STATEMENT_DEFAULT,
+    STATEMENT_LABEL,
+    STATEMENT_GOTO,
+    STATEMENT_BREAK,
+    STATEMENT_CONTINUE,
+    STATEMENT_EMPTY,
+    STATEMENT_TYPEDEF,
+    STATEMENT_STATIC, /*declarations in a block with these storage classes*/
+    STATEMENT_EXTERN
+} StatementTag;
+
+typedef enum {
+    EXPRESSION_IDENTIFIER,
+    EXPRESSION_INT_LITERAL,
+    EXPRESSION_FLOAT_LITERAL,
+    EXPRESSION_CHAR_LITERAL,
+    EXPRESSION_STRING_LITERAL,
+    EXPRESSION_UNARY, /*prefix op, including ++ and --*/
+    EXPRESSION_POSTFIX, /*x++ and x--*/
+    EXPRESSION_BINARY, /*op is the operator, TOK_OPEN_BRACKET for a[i] and TOK_COMMA for the comma operator*/
+    EXPRESSION_ASSIGN, /*op is = or a compound assignment*/
+    EXPRESSION_CONDITIONAL,
+    EXPRESSION_CALL,
+    EXPRESSION_MEMBER, /*op is TOK_DOT or TOK_ARROW*/
+    EXPRESSION_CAST,
+    EXPRESSION_SIZEOF_TYPE
+} ExpressionTag;
+
+/*The arithmetic types are in order of rank, so the usual arithmetic
+  conversions pick the later of two, see sema_arithmetic*/
+typedef enum {
+    TYPE_CHAR,
+    TYPE_SIGNED_CHAR,
+    TYPE_UNSIGNED_CHAR,
+    TYPE_SHORT,
+    TYPE_UNSIGNED_SHORT,
+    TYPE_INT,
+    TYPE_UNSIGNED_INT,
+    TYPE_LONG,
+    TYPE_UNSIGNED_LONG,
+    TYPE_FLOAT,
+    TYPE_DOUBLE,
+    TYPE_LONG_DOUBLE,
+    TYPE_VOID,
+    TYPE_POINTER, /*to base*/
+    TYPE_FUNCTION, /*returning base, the parameters are in the prototype*/
+    TYPE_NAME /*a typedef name*/
+} TypeSpecifierTag;
+
+/*The tree is a handful of flat arrays. A node is an index into the array
+  of its kind, 0 meaning none, and its tag is kept apart from its operands
+  so a pass that only looks at kinds reads one byte per node. Nodes are
+  appended after their children, so walking an array in order visits
+  every child before its parent. Nothing in the arrays is a pointer: the
+  tree can be copied, or written out, as it is*/
+typedef unsigned int AstIndex;
+
+/*Types are hash-consed: Ast.types holds every distinct type once, so
+  declarations share them and two types are the same type exactly when
+  their indices are equal. A typedef name is a type of its own, kept for
+  printing, and `canonical` is the type it stands for, so types compare
+  equal through typedefs when their canonical indices are equal*/
+typedef struct TypeSpecifier TypeSpecifier;
+struct TypeSpecifier {
+    TypeSpecifierTag tag;
+    AstIndex name; /*TYPE_NAME*/
+    AstIndex base; /*TYPE_NAME, the type the typedef names, TYPE_POINTER, the type pointed to, TYPE_FUNCTION, the return type*/
+    AstIndex canonical; /*with every typedef name resolved, itself if there is none*/
+};
+
+/*What a, b and c hold depends on the tag:
+    IDENTIFIER          a = name, b = symbol once resolved
+    INT_LITERAL         a = index into values, b = IntLiteralType, c = spelling
+    FLOAT_LITERAL,
+    CHAR_LITERAL,
+    STRING_LITERAL      c = spelling
+    UNARY, POSTFIX      a = operand
+    BINARY, ASSIGN      a = lhs, b = rhs
+    CONDITIONAL         a = condition, b = then, c = otherwise
+    CALL                a = callee, b = first argument in lists, c = argument count
+    MEMBER              a = base, b = name
+    CAST                a = operand, b = type
+    SIZEOF_TYPE         b = type
+  names and spellings index Ast.names, types index Ast.types*/
+typedef struct {
+    SrcLoc loc; /*of the operator, or the only token*/
+    unsigned int op; /*TokenTag*/
+    AstIndex a;
+    AstIndex b;
+    AstIndex c;
+} AstExpression;
+
+/*  RETURN, EXPRESSION  a = expression, 0 for a bare return
+    DECLARATION,
+    STATIC, EXTERN      a = type, b = name, c = initializer, d = symbol once resolved
+    COMPOUND            a = first statement in lists, b = statement count
+    IF                  a = condition, b = then, c = otherwise
+    WHILE, DO, SWITCH   a = condition, b = body
+    FOR                 a = init, b = condition, c = step, d = body
+    CASE                a = value, an integer literal once folded, b = body
+    DEFAULT             b = body
+    LABEL               a = name, b = body
+    GOTO                a = name
+    TYPEDEF             a = type, b = name*/
+typedef struct {
+    SrcLoc loc;
+    AstIndex a;
+    AstIndex b;
+    AstIndex c;
+    AstIndex d;
+} AstStatement;
+
+typedef struct {
+    unsigned int offset; /*into Ast.strings, NUL terminated*/
+    unsigned int len;
+} AstString;
+
+typedef struct {
+    AstIndex type;
+    AstIndex name; /*0 if the prototype leaves it out*/
+} FunctionParameter;
+
+typedef enum {
+    SYMBOL_GLOBAL,
+    SYMBOL_FUNCTION,
+    SYMBOL_PARAMETER,
+    SYMBOL_LOCAL,
+    SYMBOL_STATIC, /*declared static or extern in a block, not in the frame*/
+    SYMBOL_TYPEDEF
+} SymbolKind;
+
+/*A declaration names resolve to, made by the semantic pass. Parameters
+  and locals have a slot in the frame of their function, the parameters
+  first in order and then every local of the body in order*/
+typedef struct {
+    SymbolKind kind;
+    AstIndex name;
+    AstIndex type;
+    AstIndex declaration; /*toplevel index, Ast.parameters index or declaration statement*/
+    unsigned int slot; /*SYMBOL_PARAMETER and SYMBOL_LOCAL*/
+    core_Bool defined; /*a function with a body or a global with an initializer, here or in an earlier declaration*/
+} AstSymbol;
+
+typedef struct {
+    core_Vec(unsigned char) expression_tags; /*ExpressionTag*/
+    core_Vec(AstExpression) expressions;
+    core_Vec(unsigned char) statement_tags; /*StatementTag*/
+    core_Vec(AstStatement) statements;
+    core_Vec(AstIndex) lists; /*arguments and block statements, each list contiguous*/
+    core_Vec(unsigned long) values; /*of integer literals*/
+    core_Vec(TypeSpecifier) types; /*each distinct type once, see TypeSpecifier*/
+    core_Vec(FunctionParameter) parameters; /*of prototypes, each prototype's contiguous*/
+    core_Vec(AstString) names; /*interned identifiers and literal spellings*/
+    core_Vec(char) strings;
+    core_Vec(AstIndex) expression_types; /*filled by the semantic pass, 0 where unknown*/
+    core_Vec(AstSymbol) symbols; /*index 0 is none, see AstSymbol*/
+
+    core_Hashmap(AstIndex) name_map; /*spelling to names index, only used while building*/
+    core_Vec(AstIndex) type_buckets; /*open addressed types indices, 0 for free, only used while building*/
+} Ast;
+
+typedef struct {
+    AstIndex name;
+    AstIndex return_type;
+    unsigned int first_parameter; /*in Ast.parameters*/
+    unsigned int parameter_count;
+    core_Bool unspecified; /*declared f(), which says nothing of the parameters, unlike f(void)*/
+} FunctionPrototype;
+
+typedef struct {
+    FunctionPrototype prototype;
+    AstIndex body; /*compound statement, 0 for a prototype or a body not parsed yet*/
+
+    /*A body skipped by a parser with skip_bodies, braces included, as a
+      range of Parser.skipped. See parse_function_body*/
+    unsigned int skipped_first;
+    unsigned int skipped_count; /*0 once parsed, or if never skipped*/
+    unsigned int typedef_mark; /*Parser.typedef_log length at the '{'*/
+    unsigned int frame_size; /*slots of parameters and locals, set by the semantic pass*/
+} FunctionDefinition;
+
+typedef struct {
+    ToplevelTag tag;
+    StorageClass storage; /*STORAGE_NONE, STORAGE_STATIC or STORAGE_EXTERN*/
+    SrcLoc loc; /*of the name*/
+    union {
+        FunctionDefinition function_definition;
+        struct { /*and TOPLEVEL_TYPEDEF, without an init*/
+            AstIndex type;
+            AstIndex name;
+            AstIndex init;
+        } declaration;
+    } as;
+} Toplevel;
+
+/*Nothing in a toplevel is a pointer either, names, types and parameters
+  are in the Ast*/
+typedef core_Vec(Toplevel) Toplevels;
+
+typedef struct {
+    AstIndex name;
+    AstIndex was; /*the type the name stood for, 0 if it was not a typedef name*/
+    AstIndex now;
+} TypedefChange;
+
+typedef struct {
+    TokenStream * s;
+    core_Arena * arena;
+    Ast * ast;
+    const Ast * declarations; /*holds the prototypes of the bodies parsed, ast unless set otherwise*/
+    Diagnostics * diag; /*a syntax error is fatal, see parse_fail*/
+    core_Vec(AstIndex) scratch; /*lists being parsed, nested ones on top of their parents*/
+
+    /*Function bodies are only brace matched and their tokens kept here,
+      for consumers that only need declarations or parse bodies on demand*/
+    core_Bool skip_bodies;
+    Tokens skipped;
+
+    /*The type each Ast name stands for while it is a typedef name in
+      scope, 0 otherwise, so telling a declaration from an expression is a
+      hash lookup and an array load. Every change is logged: leaving a
+      block undoes the changes made in it, and a body parsed after the rest
+      of the file winds the file scope ones back to where the body was*/
+    core_Vec(AstIndex) typedefs;
+    core_Vec(TypedefChange) typedef_log;
+    unsigned int typedefs_applied; /*file scope entries of typedef_log the table reflects*/
+} Parser;
+
+void ast_init(Ast * ast, core_Arena * a) {
+    AstExpression none_expression;
+    AstStatement none_statement;
+    AstString none_string;
+    TypeSpecifier none_type;
+    AstSymbol none_symbol;
+    memset(ast, 0, sizeof(*ast));
+    memset(&none_expression, 0, sizeof(none_expression));
+    memset(&none_statement, 0, sizeof(none_statement));
+    memset(&none_string, 0, sizeof(none_string));
+    memset(&none_type, 0, sizeof(none_type));
+    memset(&none_symbol, 0, sizeof(none_symbol));
+    /*index 0 of every array is the missing node*/
+    core_vec_append(&ast->expression_tags, a, 0);
+    core_vec_append(&ast->expressions, a, none_expression);
+    core_vec_append(&ast->statement_tags, a, 0);
+    core_vec_append(&ast->statements, a, none_statement);
+    core_vec_append(&ast->names, a, none_string);
+    core_vec_append(&ast->strings, a, 0);
+    core_vec_append(&ast->types, a, none_type);
+    core_vec_append(&ast->symbols, a, none_symbol);
+}
+
+AstIndex ast_intern(Ast * ast, core_Arena * a, Str text) {
+    const AstIndex * found = core_hashmap_getn(&ast->name_map, text.ptr, text.len);
+    AstString name;
+    unsigned int i;
+    if(found) return *found;
+    name.offset = ast->strings.len;
+    name.len = text.len;
+    for(i = 0; i < text.len; ++i) core_vec_append(&ast->strings, a, text.ptr[i]);
+    core_vec_append(&ast->strings, a, 0);
+    core_vec_append(&ast->names, a, name);
+    core_hashmap_set(&ast->name_map, a, ast->strings.items + name.offset, ast->names.len - 1);
+    return ast->names.len - 1;
+}
+
+Str ast_name(const Ast * ast, AstIndex name) {
+    Str s;
+    s.ptr = ast->strings.items + ast->names.items[name].offset;
+    s.len = ast->names.items[name].len;
+    return s;
+}
+
+AstIndex ast_add_expression(Parser * p, ExpressionTag tag, const Token * tok, AstIndex a, AstIndex b, AstIndex c) {
+    AstExpression e;
+    e.loc = tok->loc;
+    e.op = tok->tag;
+    e.a = a;
+    e.b = b;
+    e.c = c;
+    core_vec_append(&p->ast->expression_tags, p->arena, (unsigned char)tag);
+    core_vec_append(&p->ast->expressions, p->arena, e);
+    return p->ast->expressions.len - 1;
+}
+
+AstIndex ast_add_statement(Parser * p, StatementTag tag, SrcLoc loc, AstIndex a, AstIndex b, AstIndex c, AstIndex d) {
+    AstStatement st;
+    st.loc = loc;
+    st.a = a;
+    st.b = b;
+    st.c = c;
+    st.d = d;
+    core_vec_append(&p->ast->statement_tags, p->arena, (unsigned char)tag);
+    core_vec_append(&p->ast->statements, p->arena, st);
+    return p->ast->statements.len - 1;
+}
+
+/*Moves the scratch entries from `mark` on to Ast.lists, returning where they start*/
+AstIndex parser_end_list(Parser * p, unsigned int mark) {
+    const AstIndex first = p->ast->lists.len;
+    unsigned int i;
+    for(i = mark; i < p->scratch.len; ++i) core_vec_append(&p->ast->lists, p->arena, p->scratch.items[i]);
+    p->scratch.len = mark;
+    return first;
+}
+
+#define ast_type_hash(tag, name, base) ((((unsigned long)(tag) * 31 + (name)) * 31 + (base)) * 2654435761UL)
+
+void ast_rehash_types(Ast * ast, core_Arena * a) {
+    const unsigned int cap = CORE_MAX(16, ast->type_buckets.cap * 2);
+    const unsigned long mask = cap - 1;
+    AstIndex * buckets = core_arena_alloc(a, sizeof(AstIndex) * cap);
+    unsigned int i;
+    memset(buckets, 0, sizeof(AstIndex) * cap);
+    for(i = 1; i < ast->types.len; ++i) {
+        const TypeSpecifier * t = &ast->types.items[i];
+        unsigned long k = ast_type_hash(t->tag, t->name, t->base) & mask;
+        while(buckets[k] != 0) k = (k + 1) & mask;
+        buckets[k] = i;
+    }
+    if(ast->type_buckets.items) core_arena_reclaim_memory(a, ast->type_buckets.items);
+    ast->type_buckets.items = buckets;
+    ast->type_buckets.len = cap;
+    ast->type_buckets.cap = cap;
+}
+
+/*The index of the type, added if it is not in the table yet*/
+AstIndex ast_type(Ast * ast, core_Arena * a, TypeSpecifierTag tag, AstIndex name, AstIndex base) {
+    TypeSpecifier t;
+    unsigned long mask;
+    unsigned long k;
+    if(ast->types.len * 2 >= ast->type_buckets.len) ast_rehash_types(ast, a);
+    mask = ast->type_buckets.len - 1;
+    for(k = ast_type_hash(tag, name, base) & mask; ast->type_buckets.items[k] != 0; k = (k + 1) & mask) {
+        const TypeSpecifier * other = &ast->types.items[ast->type_buckets.items[k]];
+        if(other->tag == tag && other->name == name && other->base == base) return ast->type_buckets.items[k];
+    }
+    t.tag = tag;
+    t.name = name;
+    t.base = base;
+    t.canonical = ast->types.len;
+    if(tag == TYPE_NAME) {
+        t.canonical = ast->types.items[base].canonical;
+    } else if((tag == TYPE_POINTER || tag == TYPE_FUNCTION) && ast->types.items[base].canonical != base) {
+        /*may add types and rehash, so the slot is looked for again*/
+        t.canonical = ast_type(ast, a, tag, 0, ast->types.items[base].canonical);
+        mask = ast->type_buckets.len - 1;
+        for(k = ast_type_hash(tag, name, base) & mask; ast->type_buckets.items[k] != 0; k = (k + 1) & mask) {}
+    }
+    core_vec_append(&ast->types, a, t);
+    ast->type_buckets.items[k] = ast->types.len - 1;
+    return ast->types.len - 1;
+}
+
+#define ast_same_type(ast, lhs, rhs) ((ast)->types.items[lhs].canonical == (ast)->types.items[rhs].canonical)
+
+/*The type `type` of src, in dst*/
+AstIndex ast_copy_type(Ast * dst, core_Arena * a, const Ast * src, AstIndex type) {
+    const TypeSpecifier * t = &src->types.items[type];
+    AstIndex name = 0;
+    AstIndex base = 0;
+    if(type == 0) return 0;
+    if(t->name) name = ast_intern(dst, a, ast_name(src, t->name));
+    if(t->base) base = ast_copy_type(dst, a, src, t->base);
+    return ast_type(dst, a, t->tag, name, base);
+}
+
+/*Reports `msg` at the current token and abandons the parse. There is no
+  recovery yet, the first syntax error ends the compile*/
+CORE_NORETURN void parse_fail(Parser * p, const char * msg) {
+    diag_fatal(p->diag, ts_current(p->s)->loc, msg);
+}
+
+/*Precedence of every infix and postfix operator, higher binds tighter.
+  Prefix operators and casts sit at PREC_UNARY, between the two*/
+enum {
+    PREC_NONE,
+    PREC_COMMA,
+    PREC_ASSIGN, /*right associative*/
+    PREC_CONDITIONAL, /*right associative*/
+    PREC_OR_OR,
+    PREC_AND_AND,
+    PREC_PIPE,
+    PREC_CARET,
+    PREC_AMPERSAND,
+    PREC_EQUALITY,
+    PREC_RELATIONAL,
+    PREC_SHIFT,
+    PREC_ADDITIVE,
+    PREC_MULTIPLICATIVE,
+    PREC_UNARY,
+    PREC_POSTFIX
+};
+
+#define DO_INFIX_OPERATORS(x)                                                                   \
+    x(TOK_COMMA, PREC_COMMA, EXPRESSION_BINARY)                                                 \
+    x(TOK_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN) x(TOK_STAR_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN)       \
+    x(TOK_SLASH_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN) x(TOK_PERCENT_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN) \
+    x(TOK_PLUS_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN) x(TOK_MINUS_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN)   \
+    x(TOK_SHL_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN) x(TOK_SHR_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN)     \
+    x(TOK_AND_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN) x(TOK_XOR_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN)     \
+    x(TOK_OR_ASSIGN, PREC_ASSIGN, EXPRESSION_ASSIGN)                                            \
+    x(TOK_QUESTION, PREC_CONDITIONAL, EXPRESSION_CONDITIONAL)                                   \
+    x(TOK_OR_OR, PREC_OR_OR, EXPRESSION_BINARY)                                                 \
+    x(TOK_AND_AND, PREC_AND_AND, EXPRESSION_BINARY)                                             \
+    x(TOK_PIPE, PREC_PIPE, EXPRESSION_BINARY)                                                   \
+    x(TOK_CARET, PREC_CARET, EXPRESSION_BINARY)                                                 \
+    x(TOK_AMPERSAND, PREC_AMPERSAND, EXPRESSION_BINARY)                                         \
+    x(TOK_EQ_EQ, PREC_EQUALITY, EXPRESSION_BINARY) x(TOK_NOT_EQ, PREC_EQUALITY, EXPRESSION_BINARY)         \
+    x(TOK_LT, PREC_RELATIONAL, EXPRESSION_BINARY) x(TOK_GT, PREC_RELATIONAL, EXPRESSION_BINARY)           \
+    x(TOK_LE, PREC_RELATIONAL, EXPRESSION_BINARY) x(TOK_GE, PREC_RELATIONAL, EXPRESSION_BINARY)           \
+    x(TOK_SHL, PREC_SHIFT, EXPRESSION_BINARY) x(TOK_SHR, PREC_SHIFT, EXPRESSION_BINARY)                   \
+    x(TOK_PLUS, PREC_ADDITIVE, EXPRESSION_BINARY) x(TOK_MINUS, PREC_ADDITIVE, EXPRESSION_BINARY)         \
+    x(TOK_STAR, PREC_MULTIPLICATIVE, EXPRESSION_BINARY) x(TOK_SLASH, PREC_MULTIPLICATIVE, EXPRESSION_BINARY) \
+    x(TOK_PERCENT, PREC_MULTIPLICATIVE, EXPRESSION_BINARY)                                      \
+    x(TOK_OPEN_PARENS, PREC_POSTFIX, EXPRESSION_CALL)                                           \
+    x(TOK_OPEN_BRACKET, PREC_POSTFIX, EXPRESSION_BINARY)                                        \
+    x(TOK_DOT, PREC_POSTFIX, EXPRESSION_MEMBER) x(TOK_ARROW, PREC_POSTFIX, EXPRESSION_MEMBER)             \
+    x(TOK_PLUS_PLUS, PREC_POSTFIX, EXPRESSION_POSTFIX) x(TOK_MINUS_MINUS, PREC_POSTFIX, EXPRESSION_POSTFIX)
+
+typedef struct {
+    unsigned char precedence; /*PREC_NONE if the token is not an infix operator*/
+    unsigned char tag; /*ExpressionTag of the node it makes*/
+} InfixOperator;
+
+#define INFIX_ENTRY(tok, prec, expr) infix_operators[tok].precedence = prec; infix_operators[tok].tag = expr;
+
+static InfixOperator infix_operators[TOK_COUNT];
+
+/*Run once per process, see parser_init*/
+void parser_init_tables(void) {
+    DO_INFIX_OPERATORS(INFIX_ENTRY)
+}
+
+core_Bool token_starts_type_name(TokenTag tag) {
+    switch(tag) {
+    case TOK_VOID: case TOK_CHAR: case TOK_SHORT: case TOK_INT: case TOK_LONG:
+    case TOK_FLOAT: case TOK_DOUBLE: case TOK_SIGNED: case TOK_UNSIGNED:
+    case TOK_CONST: case TOK_VOLATILE:
+        return CORE_TRUE;
+    default:
+        return CORE_FALSE;
+    }
+}
+
+StorageClass token_storage_class(TokenTag tag) {
+    switch(tag) {
+    case TOK_STATIC: return STORAGE_STATIC;
+    case TOK_EXTERN: return STORAGE_EXTERN;
+    case TOK_AUTO: return STORAGE_AUTO;
+    case TOK_REGISTER: return STORAGE_REGISTER;
+    case TOK_TYPEDEF: return STORAGE_TYPEDEF;
+    default: return STORAGE_NONE;
+    }
+}
+
+/*The Ast name spelled `text`, 0 if it was never interned*/
+AstIndex parser_lookup_name(Parser * p, Str text) {
+    const AstIndex * name = core_hashmap_getn(&p->ast->name_map, text.ptr, text.len);
+    return name ? *name : 0;
+}
+
+/*The type a typedef name in scope stands for, 0 if `text` is not one*/
+AstIndex parser_typedef_type(Parser * p, Str text) {
+    AstIndex name;
+    if(p->typedef_log.len == 0) return 0;
+    name = parser_lookup_name(p, text);
+    return name < p->typedefs.len ? p->typedefs.items[name] : 0;
+}
+
+/*Makes `name` a typedef name for `type`, or with a type of 0 an ordinary
+  identifier, from here to the end of the current scope*/
+void parser_declare(Parser * p, AstIndex name, AstIndex type) {
+    TypedefChange change;
+    if((name < p->typedefs.len ? p->typedefs.items[name] : 0) == type) return;
+    while(p->typedefs.len <= name) core_vec_append(&p->typedefs, p->arena, 0);
+    change.name = name;
+    change.was = p->typedefs.items[name];
+    change.now = type;
+    if(p->typedefs_applied == p->typedef_log.len) ++p->typedefs_applied;
+    core_vec_append(&p->typedef_log, p->arena, change);
+    p->typedefs.items[name] = type;
+}
+
+/*Undoes the changes logged since the log was `mark` entries long*/
+void parser_leave_scope(Parser * p, unsigned int mark) {
+    while(p->typedef_log.len > mark) {
+        const TypedefChange change = p->typedef_log.items[--p->typedef_log.len];
+        p->typedefs.items[change.name] = change.was;
+    }
+    p->typedefs_applied = CORE_MIN(p->typedefs_applied, mark);
+}
+
+/*Sets the table to what it was when the log was `mark` entries long,
+  outside of any block*/
+void parser_seek_typedefs(Parser * p, unsigned int mark) {
+    while(p->typedefs_applied < mark) {
+        const TypedefChange change = p->typedef_log.items[p->typedefs_applied++];
+        p->typedefs.items[change.name] = change.now;
+    }
+    while(p->typedefs_applied > mark) {
+        const TypedefChange change = p->typedef_log.items[--p->typedefs_applied];
+        p->typedefs.items[change.name] = change.was;
+    }
+}
+
+core_Bool parser_starts_type_name(Parser * p, const Token * tok) {
+    if(tok->tag == TOK_IDENTIFIER) return parser_typedef_type(p, tok->text) != 0;
+    return token_starts_type_name(tok->tag);
+}
+
+/*The keywords a basic type is spelled with, in any order*/
+enum {
+    TYPE_WORD_VOID = 1 << 0,
+    TYPE_WORD_CHAR = 1 << 1,
+    TYPE_WORD_SHORT = 1 << 2,
+    TYPE_WORD_INT = 1 << 3,
+    TYPE_WORD_LONG = 1 << 4,
+    TYPE_WORD_FLOAT = 1 << 5,
+    TYPE_WORD_DOUBLE = 1 << 6,
+    TYPE_WORD_SIGNED = 1 << 7,
+    TYPE_WORD_UNSIGNED = 1 << 8
+};
+
+/*Every set of keywords that makes a type, see C89 3.5.2*/
+static const struct {
+    unsigned int words;
+    TypeSpecifierTag tag;
+} basic_types[] = {
+    {TYPE_WORD_VOID, TYPE_VOID},
+    {TYPE_WORD_CHAR, TYPE_CHAR},
+    {TYPE_WORD_SIGNED | TYPE_WORD_CHAR, TYPE_SIGNED_CHAR},
+    {TYPE_WORD_UNSIGNED | TYPE_WORD_CHAR, TYPE_UNSIGNED_CHAR},
+    {TYPE_WORD_SHORT, TYPE_SHORT},
+    {TYPE_WORD_SHORT | TYPE_WORD_INT, TYPE_SHORT},
+    {TYPE_WORD_SIGNED | TYPE_WORD_SHORT, TYPE_SHORT},
+    {TYPE_WORD_SIGNED | TYPE_WORD_SHORT | TYPE_WORD_INT, TYPE_SHORT},
+    {TYPE_WORD_UNSIGNED | TYPE_WORD_SHORT, TYPE_UNSIGNED_SHORT},
+    {TYPE_WORD_UNSIGNED | TYPE_WORD_SHORT | TYPE_WORD_INT, TYPE_UNSIGNED_SHORT},
+    {TYPE_WORD_INT, TYPE_INT},
+    {TYPE_WORD_SIGNED, TYPE_INT},
+    {TYPE_WORD_SIGNED | TYPE_WORD_INT, TYPE_INT},
+    {TYPE_WORD_UNSIGNED, TYPE_UNSIGNED_INT},
+    {TYPE_WORD_UNSIGNED | TYPE_WORD_INT, TYPE_UNSIGNED_INT},
+    {TYPE_WORD_LONG, TYPE_LONG},
+    {TYPE_WORD_LONG | TYPE_WORD_INT, TYPE_LONG},
+    {TYPE_WORD_SIGNED | TYPE_WORD_LONG, TYPE_LONG},
+    {TYPE_WORD_SIGNED | TYPE_WORD_LONG | TYPE_WORD_INT, TYPE_LONG},
+    {TYPE_WORD_UNSIGNED | TYPE_WORD_LONG, TYPE_UNSIGNED_LONG},
+    {TYPE_WORD_UNSIGNED | TYPE_WORD_LONG | TYPE_WORD_INT, TYPE_UNSIGNED_LONG},
+    {TYPE_WORD_FLOAT, TYPE_FLOAT},
+    {TYPE_WORD_DOUBLE, TYPE_DOUBLE},
+    {TYPE_WORD_LONG | TYPE_WORD_DOUBLE, TYPE_LONG_DOUBLE}
+};
+
+unsigned int token_type_word(TokenTag tag) {
+    switch(tag) {
+    case TOK_VOID: return TYPE_WORD_VOID;
+    case TOK_CHAR: return TYPE_WORD_CHAR;
+    case TOK_SHORT: return TYPE_WORD_SHORT;
+    case TOK_INT: return TYPE_WORD_INT;
+    case TOK_LONG: return TYPE_WORD_LONG;
+    case TOK_FLOAT: return TYPE_WORD_FLOAT;
+    case TOK_DOUBLE: return TYPE_WORD_DOUBLE;
+    case TOK_SIGNED: return TYPE_WORD_SIGNED;
+    case TOK_UNSIGNED: return TYPE_WORD_UNSIGNED;
+    default: return 0;
+    }
+}
+
+/*The specifiers of a declaration: type keywords or a single typedef name.
+  A typedef name after a type keyword is the declarator instead. const and
+  volatile are accepted and ignored. Where `storage` is set, one storage
+  class may be among them too and is stored there. Returns the type, an
+  index into Ast.types*/
+AstIndex parse_type_specifier(Parser * p, StorageClass * storage) {
+    AstIndex type = 0;
+    unsigned int words = 0;
+    unsigned int i;
+    if(storage) *storage = STORAGE_NONE;
+    for(;;) {
+        const Token * tok = ts_current(p->s);
+        const unsigned int word = token_type_word(tok->tag);
+        const StorageClass class = token_storage_class(tok->tag);
+        AstIndex base;
+        if(storage && class != STORAGE_NONE) {
+            if(*storage != STORAGE_NONE) parse_fail(p, "More than one storage class");
+            *storage = class;
+        } else if(word != 0) {
+            if(type != 0 || (words & word)) parse_fail(p, "Invalid combination of type specifiers");
+            words |= word;
+        } else if(tok->tag == TOK_IDENTIFIER && words == 0 && type == 0 && (base = parser_typedef_type(p, tok->text)) != 0) {
+            type = ast_type(p->ast, p->arena, TYPE_NAME, ast_intern(p->ast, p->arena, tok->text), base);
+        } else if(tok->tag != TOK_CONST && tok->tag != TOK_VOLATILE) {
+            break;
+        }
+        (void)ts_advance(p->s);
+    }
+    if(type != 0) return type;
+    for(i = 0; i < CORE_ARRAY_LEN(basic_types); ++i) {
+        if(basic_types[i].words == words) return ast_type(p->ast, p->arena, basic_types[i].tag, 0, 0);
+    }
+    parse_fail(p, words == 0 ? "Expected type" : "Invalid combination of type specifiers");
+    return 0;
+}
+
+/*The '*'s of a declarator, each making a pointer to what it follows*/
+AstIndex parse_pointers(Parser * p, AstIndex type) {
+    unsigned int depth = 0;
+    while(ts_expect(p->s, TOK_STAR)) {
+        if(++depth > PARSE_MAX_DEPTH) parse_fail(p, "Declarator nested too deeply");
+        while(ts_tag(p->s) == TOK_CONST || ts_tag(p->s) == TOK_VOLATILE) (void)ts_advance(p->s);
+        type = ast_type(p->ast, p->arena, TYPE_POINTER, 0, type);
+    }
+    return type;
+}
+
+AstIndex parse_expression_precedence(Parser * p, int min_precedence, unsigned int depth);
+
+#define parse_expression(p, depth) parse_expression_precedence(p, PREC_COMMA, depth)
+#define parse_assignment_expression(p, depth) parse_expression_precedence(p, PREC_ASSIGN, depth)
+
+/*`(type)` after sizeof or as a cast, the '(' is the current token*/
+AstIndex parse_parenthesized_type(Parser * p) {
+    AstIndex type;
+    (void)ts_advance(p->s);
+    type = parse_pointers(p, parse_type_specifier(p, NULL));
+    if(!ts_expect(p->s, TOK_CLOSE_PARENS)) parse_fail(p, "Expected ')'");
+    return type;
+}
+
+/*Operands, prefix operators, casts and parenthesized expressions*/
+AstIndex parse_prefix_expression(Parser * p, unsigned int depth) {
+    TokenStream * s = p->s;
+    const Token tok = *ts_current(s);
+    AstIndex type;
+    AstIndex e;
+    switch(tok.tag) {
+    case TOK_IDENTIFIER:
+        (void)ts_advance(s);
+        return ast_add_expression(p, EXPRESSION_IDENTIFIER, &tok, ast_intern(p->ast, p->arena, tok.text), 0, 0);
+    case TOK_INT_LITERAL:
+        (void)ts_advance(s);
+        core_vec_append(&p->ast->values, p->arena, tok.value);
+        return ast_add_expression(p, EXPRESSION_INT_LITERAL, &tok, p->ast->values.len - 1, tok.int_type, ast_intern(p->ast, p->arena, tok.text));
+    case TOK_FLOAT_LITERAL:
+    case TOK_CHAR_LITERAL:
+    case TOK_STRING_LITERAL:
+        (void)ts_advance(s);
+        return ast_add_expression(p, tok.tag == TOK_FLOAT_LITERAL ? EXPRESSION_FLOAT_LITERAL
+                                     : tok.tag == TOK_CHAR_LITERAL ? EXPRESSION_CHAR_LITERAL
+                                     : EXPRESSION_STRING_LITERAL, &tok, 0, 0, ast_intern(p->ast, p->arena, tok.text));
+    case TOK_OPEN_PARENS:
+        if(parser_starts_type_name(p, ts_peek(s, 1))) {
+            type = parse_parenthesized_type(p);
+            e = parse_expression_precedence(p, PREC_UNARY, depth + 1);
+            return ast_add_expression(p, EXPRESSION_CAST, &tok, e, type, 0);
+        }
+        (void)ts_advance(s);
+        e = parse_expression(p, depth + 1);
+        if(!ts_expect(s, TOK_CLOSE_PARENS)) parse_fail(p, "Expected ')'");
+        return e;
+    case TOK_SIZEOF:
+        if(ts_peek(s, 1)->tag == TOK_OPEN_PARENS && parser_starts_type_name(p, ts_peek(s, 2))) {
+            (void)ts_advance(s);
+            type = parse_parenthesized_type(p);
+            return ast_add_expression(p, EXPRESSION_SIZEOF_TYPE, &tok, 0, type, 0);
+        }
+        /*fallthrough*/
+    case TOK_AMPERSAND:
+    case TOK_STAR:
+    case TOK_PLUS:
+    case TOK_MINUS:
+    case TOK_TILDE:
+    case TOK_BANG:
+    case TOK_PLUS_PLUS:
+    case TOK_MINUS_MINUS:
+        (void)ts_advance(s);
+        e = parse_expression_precedence(p, PREC_UNARY, depth + 1);
+        return ast_add_expression(p, EXPRESSION_UNARY, &tok, e, 0, 0);
+    case TOK_EOF:
+        parse_fail(p, "Unexpected EOF, expected expression");
+        return 0;
+    default:
+        parse_fail(p, "Expected expression");
+        return 0;
+    }
+}
+
+/*Pratt parser: operators are looked up in infix_operators, and the right
+  operand is only parsed recursively for operators that bind tighter, so
+  a chain of operators of one level is parsed by the loop and the stack
+  only grows with nesting*/
+AstIndex parse_expression_precedence(Parser * p, int min_precedence, unsigned int depth) {
+    TokenStream * s = p->s;
+    AstIndex lhs;
+    if(depth > PARSE_MAX_DEPTH) parse_fail(p, "Expression nested too deeply");
+    lhs = parse_prefix_expression(p, depth);
+    for(;;) {
+        const InfixOperator op = infix_operators[ts_tag(s)];
+        const ExpressionTag tag = (ExpressionTag)op.tag;
+        Token tok;
+        Token * name;
+        AstIndex b = 0;
+        AstIndex c = 0;
+        unsigned int mark;
+        if(op.precedence == PREC_NONE || op.precedence < min_precedence) return lhs;
+        tok = *ts_advance(s);
+        switch(tag) {
+        case EXPRESSION_POSTFIX:
+            break;
+        case EXPRESSION_MEMBER:
+            name = ts_expect(s, TOK_IDENTIFIER);
+            if(!name) parse_fail(p, "Expected member name");
+            b = ast_intern(p->ast, p->arena, name->text);
+            break;
+        case EXPRESSION_CALL:
+            mark = p->scratch.len;
+            if(!ts_expect(s, TOK_CLOSE_PARENS)) {
+                do {
+                    const AstIndex arg = parse_assignment_expression(p, depth + 1);
+                    core_vec_append(&p->scratch, p->arena, arg);
+                } while(ts_expect(s, TOK_COMMA));
+                if(!ts_expect(s, TOK_CLOSE_PARENS)) parse_fail(p, "Expected ')' after arguments");
+            }
+            c = p->scratch.len - mark;
+            b = parser_end_list(p, mark);
+            break;
+        case EXPRESSION_CONDITIONAL:
+            b = parse_expression(p, depth + 1);
+            if(!ts_expect(s, TOK_COLON)) parse_fail(p, "Expected ':'");
+            c = parse_expression_precedence(p, PREC_CONDITIONAL, depth + 1);
+            break;
+        case EXPRESSION_ASSIGN:
+            b = parse_expression_precedence(p, PREC_ASSIGN, depth + 1);
+            break;
+        default:
+            if(tok.tag == TOK_OPEN_BRACKET) {
+                b = parse_expression(p, depth + 1);
+                if(!ts_expect(s, TOK_CLOSE_BRACKET)) parse_fail(p, "Expected ']'");
+            } else {
+                b = parse_expression_precedence(p, op.precedence + 1, depth + 1);
+            }
+            break;
+        }
+        lhs = ast_add_expression(p, tag, &tok, lhs, b, c);
+    }
+}
+
+core_Bool parser_should_parse_declaration(Parser * p) {
+    const Token * tok = ts_current(p->s);
+    if(token_storage_class(tok->tag) != STORAGE_NONE) return CORE_TRUE;
+    /*labels have a namespace of their own, `T:` is one even if T is a typedef*/
+    if(tok->tag == TOK_IDENTIFIER && ts_peek(p->s, 1)->tag == TOK_COLON) return CORE_FALSE;
+    return parser_starts_type_name(p, tok);
+}
+
+AstIndex parse_statement_depth(Parser * p, unsigned int depth);
+
+/*`(expression)` of if, while, do and switch*/
+AstIndex parse_condition(Parser * p, unsigned int depth) {
+    AstIndex e;
+    if(!ts_expect(p->s, TOK_OPEN_PARENS)) parse_fail(p, "Expected '('");
+    e = parse_expression(p, depth + 1);
+    if(!ts_expect(p->s, TOK_CLOSE_PARENS)) parse_fail(p, "Expected ')'");
+    return e;
+}
+
+void parse_semicolon(Parser * p) {
+    if(!ts_expect(p->s, TOK_SEMICOLON)) parse_fail(p, "Expected ';'");
+}
+
+/*A declaration in a block, each of its declarators a statement of its
+  own appended to p->scratch, all in the scope of the block*/
+void parse_local_declaration(Parser * p, unsigned int depth) {
+    TokenStream * s = p->s;
+    StorageClass storage;
+    const AstIndex specifier = parse_type_specifier(p, &storage);
+    StatementTag tag = STATEMENT_DECLARATION;
+    switch(storage) {
+    case STORAGE_TYPEDEF: tag = STATEMENT_TYPEDEF; break;
+    case STORAGE_STATIC: tag = STATEMENT_STATIC; break;
+    case STORAGE_EXTERN: tag = STATEMENT_EXTERN; break;
+    default: break;
+    }
+    do {
+        const AstIndex type = parse_pointers(p, specifier);
+        const SrcLoc loc = ts_current(s)->loc;
+        const Token * name = ts_expect(s, TOK_IDENTIFIER);
+        AstIndex b;
+        AstIndex c = 0;
+        if(!name) parse_fail(p, "Expected identifier");
+        b = ast_intern(p->ast, p->arena, name->text);
+        parser_declare(p, b, tag == STATEMENT_TYPEDEF ? type : 0);
+        if(tag != STATEMENT_TYPEDEF && ts_expect(s, TOK_ASSIGN)) c = parse_assignment_expression(p, depth + 1);
+        core_vec_append(&p->scratch, p->arena, ast_add_statement(p, tag, loc, type, b, c, 0));
+    } while(ts_expect(s, TOK_COMMA));
+    parse_semicolon(p);
+}
+
+/*Statements up to the closing brace, the opening one already consumed.
+  Returns the compound statement*/
+AstIndex parse_block(Parser * p, SrcLoc loc, unsigned int depth) {
+    const unsigned int mark = p->scratch.len;
+    const unsigned int scope = p->typedef_log.len;
+    unsigned int count;
+    while(!ts_expect(p->s, TOK_CLOSE_BRACE)) {
+        AstIndex st;
+        if(ts_tag(p->s) == TOK_EOF) parse_fail(p, "Unexpected EOF, expected '}'");
+        if(parser_should_parse_declaration(p)) {
+            parse_local_declaration(p, depth + 1);
+            continue;
+        }
+        st = parse_statement_depth(p, depth + 1);
+        core_vec_append(&p->scratch, p->arena, st);
+    }
+    parser_leave_scope(p, scope);
+    count = p->scratch.len - mark;
+    return ast_add_statement(p, STATEMENT_COMPOUND, loc, parser_end_list(p, mark), count, 0, 0);
+}
+
+/*Expression up to `end`, or 0 if it is empty, as in for(;;)*/
+AstIndex parse_optional_expression(Parser * p, TokenTag end, unsigned int depth) {
+    AstIndex e = 0;
+    if(ts_tag(p->s) != end) e = parse_expression(p, depth + 1);
+    if(!ts_expect(p->s, end)) parse_fail(p, end == TOK_SEMICOLON ? "Expected ';'" : "Expected ')'");
+    return e;
+}
+
+/*Expects the ':' after a label and parses the statement it labels*/
+AstIndex parse_labeled(Parser * p, unsigned int depth) {
+    if(!ts_expect(p->s, TOK_COLON)) parse_fail(p, "Expected ':'");
+    return parse_statement_depth(p, depth + 1);
+}
+
+AstIndex parse_statement_depth(Parser * p, unsigned int depth) {
+    TokenStream * s = p->s;
+    const Token first = *ts_current(s);
+    const SrcLoc loc = first.loc;
+    AstIndex a = 0;
+    AstIndex b = 0;
+    AstIndex c = 0;
+    Token * name;
+    if(depth > PARSE_MAX_DEPTH) parse_fail(p, "Statement nested too deeply");
+    /*declarations are only parsed in blocks, see parse_block*/
+    if(first.tag == TOK_EOF || parser_should_parse_declaration(p)) parse_fail(p, "Expected statement");
+
+    switch(first.tag) {
+    case TOK_OPEN_BRACE:
+        (void)ts_advance(s);
+        return parse_block(p, loc, depth);
+    case TOK_RETURN:
+        (void)ts_advance(s);
+        a = parse_optional_expression(p, TOK_SEMICOLON, depth);
+        return ast_add_statement(p, STATEMENT_RETURN, loc, a, 0, 0, 0);
+    case TOK_IF:
+        (void)ts_advance(s);
+        a = parse_condition(p, depth);
+        b = parse_statement_depth(p, depth + 1);
+        if(ts_expect(s, TOK_ELSE)) c = parse_statement_depth(p, depth + 1);
+        return ast_add_statement(p, STATEMENT_IF, loc, a, b, c, 0);
+    case TOK_WHILE:
+    case TOK_SWITCH:
+        (void)ts_advance(s);
+        a = parse_condition(p, depth);
+        b = parse_statement_depth(p, depth + 1);
+        return ast_add_statement(p, first.tag == TOK_WHILE ? STATEMENT_WHILE : STATEMENT_SWITCH, loc, a, b, 0, 0);
+    case TOK_DO:
+        (void)ts_advance(s);
+        b = parse_statement_depth(p, depth + 1);
+        if(!ts_expect(s, TOK_WHILE)) parse_fail(p, "Expected 'while'");
+        a = parse_condition(p, depth);
+        parse_semicolon(p);
+        return ast_add_statement(p, STATEMENT_DO, loc, a, b, 0, 0);
+    case TOK_FOR:
+        (void)ts_advance(s);
+        if(!ts_expect(s, TOK_OPEN_PARENS)) parse_fail(p, "Expected '('");
+        a = parse_optional_expression(p, TOK_SEMICOLON, depth);
+        b = parse_optional_expression(p, TOK_SEMICOLON, depth);
+        c = parse_optional_expression(p, TOK_CLOSE_PARENS, depth);
+        return ast_add_statement(p, STATEMENT_FOR, loc, a, b, c, parse_statement_depth(p, depth + 1));
+    case TOK_CASE:
+        (void)ts_advance(s);
+        a = parse_expression_precedence(p, PREC_CONDITIONAL, depth + 1);
+        b = parse_labeled(p, depth);
+        return ast_add_statement(p, STATEMENT_CASE, loc, a, b, 0, 0);
+    case TOK_DEFAULT:
+        (void)ts_advance(s);
+        b = parse_labeled(p, depth);
+        return ast_add_statement(p, STATEMENT_DEFAULT, loc, 0, b, 0, 0);
+    case TOK_GOTO:
+        (void)ts_advance(s);
+        name = ts_expect(s, TOK_IDENTIFIER);
+        if(!name) parse_fail(p, "Expected label");
+        a = ast_intern(p->ast, p->arena, name->text);
+        parse_semicolon(p);
+        return ast_add_statement(p, STATEMENT_GOTO, loc, a, 0, 0, 0);
+    case TOK_BREAK:
+    case TOK_CONTINUE:
+        (void)ts_advance(s);
+        parse_semicolon(p);
+        return ast_add_statement(p, first.tag == TOK_BREAK ? STATEMENT_BREAK : STATEMENT_CONTINUE, loc, 0, 0, 0, 0);
+    case TOK_SEMICOLON:
+        (void)ts_advance(s);
+        return ast_add_statement(p, STATEMENT_EMPTY, loc, 0, 0, 0, 0);
+    default:
+        if(first.tag == TOK_IDENTIFIER && ts_peek(s, 1)->tag == TOK_COLON) {
+            (void)ts_advance(s);
+            a = ast_intern(p->ast, p->arena, first.text);
+            b = parse_labeled(p, depth);
+            return ast_add_statement(p, STATEMENT_LABEL, loc, a, b, 0, 0);
+        }
+        a = parse_expression(p, depth + 1);
+        parse_semicolon(p);
+        return ast_add_statement(p, STATEMENT_EXPRESSION, loc, a, 0, 0, 0);
+    }
+}
+
+AstIndex parse_statement(Parser * p) {
+    return parse_statement_depth(p, 0);
+}
+
+/*Records the tokens of the body starting at the current '{' up to its
+  matching '}' without parsing them*/
+void skip_function_body(Parser * p, FunctionDefinition * out) {
+    TokenStream * s = p->s;
+    unsigned long depth = 0;
+    out->skipped_first = p->skipped.len;
+    do {
+        const Token * tok = ts_advance(s);
+        switch(tok->tag) {
+        case TOK_OPEN_BRACE: ++depth; break;
+        case TOK_CLOSE_BRACE: --depth; break;
+        case TOK_EOF: parse_fail(p, "Unexpected EOF, expected '}'"); break;
+        default: break;
+        }
+        core_vec_append(&p->skipped, p->arena, *tok);
+    } while(depth > 0);
+    out->skipped_count = p->skipped.len - out->skipped_first;
+}
+
+/*The body of a function, the current token its '{'. The parameters are
+  declared in it, shadowing typedef names of the same spelling*/
+AstIndex parse_function_block(Parser * p, const FunctionPrototype * prototype) {
+    const unsigned int scope = p->typedef_log.len;
+    AstIndex body;
+    unsigned int i;
+    for(i = 0; i < prototype->parameter_count; ++i) {
+        const FunctionParameter * param = &p->declarations->parameters.items[prototype->first_parameter + i];
+        const AstIndex name = param->name ? parser_lookup_name(p, ast_name(p->declarations, param->name)) : 0;
+        if(name) parser_declare(p, name, 0);
+    }
+    body = parse_block(p, ts_advance(p->s)->loc, 0);
+    parser_leave_scope(p, scope);
+    return body;
+}
+
+/*The parameters after the name of a function, its return type and name
+  already parsed. A parameter may leave its name out*/
+void parse_function_declarator(Parser * p, AstIndex return_type, Str name_text, FunctionDefinition * out) {
+    TokenStream * s = p->s;
+    Token * name = NULL;
+    core_Bool more_parameters = CORE_TRUE;
+    out->prototype.return_type = return_type;
+    out->prototype.name = ast_intern(p->ast, p->arena, name_text);
+    out->prototype.first_parameter = p->ast->parameters.len;
+    parser_declare(p, out->prototype.name, 0);
+    if(!ts_expect(s, TOK_OPEN_PARENS)) parse_fail(p, "Expected '('");
+    if(ts_tag(s) == TOK_VOID && ts_peek(s, 1)->tag == TOK_CLOSE_PARENS) {
+        (void)ts_advance(s);
+        more_parameters = CORE_FALSE;
+    } else if(ts_tag(s) == TOK_CLOSE_PARENS) {
+        more_parameters = CORE_FALSE;
+        out->prototype.unspecified = CORE_TRUE;
+    }
+    while(more_parameters) {
+        FunctionParameter param;
+        StorageClass storage;
+        param.type = parse_pointers(p, parse_type_specifier(p, &storage));
+        if(storage != STORAGE_NONE && storage != STORAGE_REGISTER) parse_fail(p, "Invalid storage class for a parameter");
+        name = ts_expect(s, TOK_IDENTIFIER);
+        param.name = name ? ast_intern(p->ast, p->arena, name->text) : 0;
+        core_vec_append(&p->ast->parameters, p->arena, param);
+        more_parameters = ts_expect(s, TOK_COMMA) != NULL;
+    }
+    out->prototype.parameter_count = p->ast->parameters.len - out->prototype.first_parameter;
+    if(ts_tag(s) == TOK_EOF) parse_fail(p, "Unexpected EOF");
+    if(!ts_expect(s, TOK_CLOSE_PARENS)) parse_fail(p, "Expected ')'");
+}
+
+/*The body of a function declared by parse_function_declarator, the
+  current token its '{'*/
+void parse_function_definition(Parser * p, FunctionDefinition * out) {
+    unsigned int i;
+    for(i = 0; i < out->prototype.parameter_count; ++i) {
+        if(p->ast->parameters.items[out->prototype.first_parameter + i].name == 0) {
+            parse_fail(p, "Parameter name omitted in a function definition");
+        }
+    }
+    out->typedef_mark = p->typedef_log.len;
+    if(p->skip_bodies) {
+        skip_function_body(p, out);
+        return;
+    }
+    out->body = parse_function_block(p, &out->prototype);
+}
+
+/*Parses a body skipped by skip_function_body if it has not been yet, and
+  returns its compound statement*/
+AstIndex parse_function_body(Parser * p, FunctionDefinition * def) {
+    TokenStream * outer = p->s;
+    TokenStream body;
+    Tokens range;
+    if(def->body != 0 || def->skipped_count == 0) return def->body;
+    memset(&range, 0, sizeof(range));
+    range.items = p->skipped.items + def->skipped_first;
+    range.len = def->skipped_count;
+    ts_init_tokens(&body, &range);
+    p->s = &body;
+    parser_seek_typedefs(p, def->typedef_mark);
+    def->body = parse_function_block(p, &def->prototype);
+    if(ts_tag(&body) != TOK_EOF) parse_fail(p, "Expected end of function body");
+    p->s = outer;
+    def->skipped_count = 0;
+    return def->body;
+}
+
+/*A declaration at file scope, each of its declarators a toplevel of its
+  own. Whether a declarator is a function is only known at the '(' after
+  its name, and only a function declared alone can have a body*/
+void parse_declaration(Parser * p, Toplevels * out) {
+    TokenStream * s = p->s;
+    StorageClass storage;
+    const AstIndex specifier = parse_type_specifier(p, &storage);
+    const unsigned int first = out->len;
+    if(storage == STORAGE_AUTO || storage == STORAGE_REGISTER) parse_fail(p, "Invalid storage class at file scope");
+    do {
+        const AstIndex type = parse_pointers(p, specifier);
+        Toplevel top;
+        Str name;
+        memset(&top, 0, sizeof(top));
+        if(ts_tag(s) != TOK_IDENTIFIER) parse_fail(p, "Expected identifier");
+        top.loc = ts_current(s)->loc;
+        name = ts_advance(s)->text;
+        if(storage == STORAGE_TYPEDEF) {
+            top.tag = TOPLEVEL_TYPEDEF;
+            top.as.declaration.type = type;
+            top.as.declaration.name = ast_intern(p->ast, p->arena, name);
+            parser_declare(p, top.as.declaration.name, type);
+        } else if(ts_tag(s) == TOK_OPEN_PARENS) {
+            top.tag = TOPLEVEL_FUNCTION_DEFINITION;
+            top.storage = storage;
+            parse_function_declarator(p, type, name, &top.as.function_definition);
+            if(out->len == first && ts_tag(s) == TOK_OPEN_BRACE) {
+                parse_function_definition(p, &top.as.function_definition);
+                core_vec_append(out, p->arena, top);
+                return;
+            }
+        } else {
+            top.tag = TOPLEVEL_DECLARATION;
+            top.storage = storage;
+            top.as.declaration.type = type;
+            top.as.declaration.name = ast_intern(p->ast, p->arena, name);
+            parser_declare(p, top.as.declaration.name, 0);
+            if(ts_expect(s, TOK_ASSIGN)) top.as.declaration.init = parse_assignment_expression(p, 0);
+        }
+        core_vec_append(out, p->arena, top);
+    } while(ts_expect(s, TOK_COMMA));
+    parse_semicolon(p);
+}
+
+void parse_toplevel(Parser * p, Toplevels * out) {
+    if(!parser_should_parse_declaration(p)) parse_fail(p, "Toplevel form not supported yet");
+    parse_declaration(p, out);
+}
+
+static pthread_once_t infix_operators_once = PTHREAD_ONCE_INIT;
+
+void parser_init(Parser * p, TokenStream * s, core_Arena * a, Ast * ast, Diagnostics * diag) {
+    memset(p, 0, sizeof(*p));
+    p->s = s;
+    p->arena = a;
+    p->ast = ast;
+    p->declarations = ast;
+    p->diag = diag;
+    pthread_once(&infix_operators_once, parser_init_tables);
+}
+
+Toplevels parse_translation_unit(Parser * p) {
+    Toplevels t = {0};
+    while(ts_tag(p->s) != TOK_EOF) parse_toplevel(p, &t);
+    return t;
+}
+
+/**** PARALLEL PARSING ****/
+
+/*Once the toplevel has been skimmed every skipped body can be parsed on
+  its own. The bodies are split into contiguous runs of about equal token
+  counts, each parsed by one thread into an Ast of its own, and the trees
+  are then appended in order. That gives the same arrays a sequential
+  parse of the bodies would have*/
+#define PARSE_MAX_THREADS 64
+
+typedef struct {
+    const Parser * parent; /*the skim, read only while the runs parse*/
+    FunctionDefinition ** defs;
+    unsigned int count;
+    core_Arena arena; /*per thread, freed once merged*/
+    Ast ast;
+    Diagnostics diag;
+    core_Bool failed; /*a body had a syntax error, the rest of the run was not parsed*/
+    pthread_t thread;
+    core_Bool spawned;
+} BodyRun;
+
+void * parse_body_run(void * ctx) {
+    BodyRun * run = ctx;
+    const Parser * parent = run->parent;
+    const unsigned int log_len = run->defs[run->count - 1]->typedef_mark;
+    Parser p;
+    jmp_buf bail;
+    unsigned int i;
+    ast_init(&run->ast, &run->arena);
+    diag_init(&run->diag, parent->diag->sm, &run->arena, NULL);
+    run->diag.bail = &bail;
+    parser_init(&p, NULL, &run->arena, &run->ast, &run->diag);
+    p.declarations = parent->ast;
+    p.skipped = parent->skipped;
+    if(setjmp(bail) != 0) {
+        run->failed = CORE_TRUE;
+        return NULL;
+    }
+
+    /*the file scope typedef changes the bodies can see, renamed into this tree*/
+    for(i = 0; i < log_len; ++i) {
+        TypedefChange change = parent->typedef_log.items[i];
+        change.name = ast_intern(&run->ast, &run->arena, ast_name(parent->ast, change.name));
+        change.was = ast_copy_type(&run->ast, &run->arena, parent->ast, change.was);
+        change.now = ast_copy_type(&run->ast, &run->arena, parent->ast, change.now);
+        core_vec_append(&p.typedef_log, &run->arena, change);
+    }
+    while(p.typedefs.len < run->ast.names.len) core_vec_append(&p.typedefs, &run->arena, 0);
+
+    for(i = 0; i < run->count; ++i) (void)parse_function_body(&p, run->defs[i]);
+    return NULL;
+}
+
+#define ast_relocate(index, offset) ((index) ? (index) + (offset) : 0)
+
+/*Appends every node of src to dst. Indices are shifted past the nodes
+  already in dst and names are interned again. The offsets added to
+  statement indices is returned, so roots held outside the tree can be
+  moved too. src must not have been through the semantic pass yet*/
+AstIndex ast_append(Ast * dst, core_Arena * a, const Ast * src) {
+    const AstIndex expressions = dst->expressions.len - 1;
+    const AstIndex statements = dst->statements.len - 1;
+    const AstIndex lists = dst->lists.len;
+    const AstIndex values = dst->values.len;
+    AstIndex * names = core_arena_alloc(a, sizeof(AstIndex) * src->names.len);
+    AstIndex * types = core_arena_alloc(a, sizeof(AstIndex) * src->types.len);
+    unsigned int i, k;
+
+    names[0] = 0;
+    for(i = 1; i < src->names.len; ++i) names[i] = ast_intern(dst, a, ast_name(src, i));
+    for(i = 0; i < src->values.len; ++i) core_vec_append(&dst->values, a, src->values.items[i]);
+    for(i = 0; i < src->lists.len; ++i) core_vec_append(&dst->lists, a, src->lists.items[i]);
+    /*a type's base comes before it, so it is already mapped*/
+    types[0] = 0;
+    for(i = 1; i < src->types.len; ++i) {
+        const TypeSpecifier * t = &src->types.items[i];
+        types[i] = ast_type(dst, a, t->tag, names[t->name], types[t->base]);
+    }
+    for(i = 0; i < src->parameters.len; ++i) {
+        FunctionParameter param = src->parameters.items[i];
+        param.type = types[param.type];
+        param.name = names[param.name];
+        core_vec_append(&dst->parameters, a, param);
+    }
+
+    for(i = 1; i < src->expressions.len; ++i) {
+        const ExpressionTag tag = (ExpressionTag)src->expression_tags.items[i];
+        AstExpression e = src->expressions.items[i];
+        switch(tag) {
+        case EXPRESSION_IDENTIFIER:
+            e.a = names[e.a];
+            break;
+        case EXPRESSION_INT_LITERAL:
+            e.a += values;
+            e.c = names[e.c];
+            break;
+        case EXPRESSION_FLOAT_LITERAL:
+        case EXPRESSION_CHAR_LITERAL:
+        case EXPRESSION_STRING_LITERAL:
+            e.c = names[e.c];
+            break;
+        case EXPRESSION_CALL:
+            for(k = 0; k < e.c; ++k) dst->lists.items[lists + e.b + k] += expressions;
+            e.a = ast_relocate(e.a, expressions);
+            e.b += lists;
+            break;
+        case EXPRESSION_MEMBER:
+            e.a = ast_relocate(e.a, expressions);
+            e.b = names[e.b];
+            break;
+        case EXPRESSION_CAST:
+        case EXPRESSION_SIZEOF_TYPE:
+            e.a = ast_relocate(e.a, expressions);
+            e.b = types[e.b];
+            break;
+        case EXPRESSION_UNARY:
+        case EXPRESSION_POSTFIX:
+            e.a = ast_relocate(e.a, expressions);
+            break;
+        case EXPRESSION_BINARY:
+        case EXPRESSION_ASSIGN:
+        case EXPRESSION_CONDITIONAL:
+            e.a = ast_relocate(e.a, expressions);
+            e.b = ast_relocate(e.b, expressions);
+            e.c = ast_relocate(e.c, expressions);
+            break;
+        }
+        core_vec_append(&dst->expression_tags, a, (unsigned char)tag);
+        core_vec_append(&dst->expressions, a, e);
+    }
+
+    for(i = 1; i < src->statements.len; ++i) {
+        const StatementTag tag = (StatementTag)src->statement_tags.items[i];
+        AstStatement st = src->statements.items[i];
+        switch(tag) {
+        case STATEMENT_RETURN:
+        case STATEMENT_EXPRESSION:
+            st.a = ast_relocate(st.a, expressions);
+            break;
+        case STATEMENT_DECLARATION:
+        case STATEMENT_TYPEDEF:
+        case STATEMENT_STATIC:
+        case STATEMENT_EXTERN:
+            st.a = types[st.a];
+            st.b = names[st.b];
+            st.c = ast_relocate(st.c, expressions);
+            break;
+        case STATEMENT_COMPOUND:
+            for(k = 0; k < st.b; ++k) dst->lists.items[lists + st.a + k] += statements;
+            st.a += lists;
+            break;
+        case STATEMENT_IF:
+            st.a = ast_relocate(st.a, expressions);
+            st.b = ast_relocate(st.b, statements);
+            st.c = ast_relocate(st.c, statements);
+            break;
+        case STATEMENT_WHILE:
+        case STATEMENT_DO:
+        case STATEMENT_SWITCH:
+        case STATEMENT_CASE:
+        case STATEMENT_DEFAULT:
+            st.a = ast_relocate(st.a, expressions);
+            st.b = ast_relocate(st.b, statements);
+            break;
+        case STATEMENT_FOR:
+            st.a = ast_relocate(st.a, expressions);
+            st.b = ast_relocate(st.b, expressions);
+            st.c = ast_relocate(st.c, expressions);
+            st.d = ast_relocate(st.d, statements);
+            break;
+        case STATEMENT_LABEL:
+            st.a = names[st.a];
+            st.b = ast_relocate(st.b, statements);
+            break;
+        case STATEMENT_GOTO:
+            st.a = names[st.a];
+            break;
+        default:
+            break;
+        }
+        core_vec_append(&dst->statement_tags, a, (unsigned char)tag);
+        core_vec_append(&dst->statements, a, st);
+    }
+    core_arena_reclaim_memory(a, names);
+    core_arena_reclaim_memory(a, types);
+    return statements;
+}
+
+/*Parses every body the skim of p skipped using up to `threads` threads*/
+void parse_bodies_parallel(Parser * p, Toplevels * toplevels, unsigned int threads) {
+    BodyRun runs[PARSE_MAX_THREADS];
+    core_Vec(FunctionDefinition *) defs = {0};
+    unsigned long total = 0;
+    unsigned long done = 0;
+    unsigned int n = 0;
+    core_Bool failed = CORE_FALSE;
+    unsigned int i, k;
+
+    for(i = 0; i < toplevels->len; ++i) {
+        FunctionDefinition * def = &toplevels->items[i].as.function_definition;
+        if(toplevels->items[i].tag != TOPLEVEL_FUNCTION_DEFINITION || def->skipped_count == 0) continue;
+        core_vec_append(&defs, p->arena, def);
+        total += def->skipped_count;
+    }
+    if(defs.len == 0) return;
+    threads = CORE_MAX(1, CORE_MIN(threads, PARSE_MAX_THREADS));
+    threads = CORE_MIN(threads, defs.len);
+
+    /*contiguous runs cut at about total / threads tokens each*/
+    for(i = 0; i < defs.len; ++n) {
+        BodyRun * run = &runs[n];
+        const unsigned long goal = total * (n + 1) / threads;
+        memset(run, 0, sizeof(*run));
+        run->parent = p;
+        run->defs = defs.items + i;
+        do {
+            done += defs.items[i++]->skipped_count;
+            ++run->count;
+        } while(i < defs.len && (done < goal || n + 1 == threads));
+    }
+
+    for(i = 1; i < n; ++i) {
+        runs[i].spawned = pthread_create(&runs[i].thread, NULL, parse_body_run, &runs[i]) == 0;
+    }
+    for(i = 0; i < n; ++i) {
+        if(runs[i].spawned) pthread_join(runs[i].thread, NULL);
+        else (void)parse_body_run(&runs[i]);
+    }
+
+    for(i = 0; i < n; ++i) {
+        for(k = 0; k < runs[i].diag.items.len; ++k) {
+            const Diagnostic * d = &runs[i].diag.items.items[k];
+            diag_report(p->diag, d->loc, core_arena_strdup(p->arena, d->msg));
+        }
+        failed = failed || runs[i].failed;
+        if(!failed) {
+            const AstIndex statements = ast_append(p->ast, p->arena, &runs[i].ast);
+            for(k = 0; k < runs[i].count; ++k) runs[i].defs[k]->body += statements;
+        }
+        core_arena_free(&runs[i].arena);
+    }
+    core_arena_reclaim_memory(p->arena, defs.items);
+    if(failed) diag_bail(p->diag);
+}
+
+/*Prints the tree as S-expressions, one toplevel or statement per line*/
+void ast_fprint_type(FILE * fp, const Ast * ast, AstIndex index) {
+    static const char * const names[] = {
+        "char", "signed char", "unsigned char", "short", "unsigned short", "int", "unsigned int",
+        "long", "unsigned long", "float", "double", "long double", "void"
+    };
+    const TypeSpecifier * type = &ast->types.items[index];
+    if(type->tag == TYPE_NAME) {
+        fprintf(fp, STR_FMT, STR_ARG(ast_name(ast, type->name)));
+    } else if(type->tag == TYPE_POINTER || type->tag == TYPE_FUNCTION) {
+        fprintf(fp, type->tag == TYPE_POINTER ? "(* " : "(() ");
+        ast_fprint_type(fp, ast, type->base);
+        fprintf(fp, ")");
+    } else {
+        fprintf(fp, "%s", names[type->tag]);
+    }
+}
+
+void ast_fprint_expression(FILE * fp, const Ast * ast, AstIndex index) {
+    const AstExpression * e = &ast->expressions.items[index];
+    unsigned int i;
+    if(index == 0) {
+        fprintf(fp, "()");
+        return;
+    }
+    switch((ExpressionTag)ast->expression_tags.items[index]) {
+    case EXPRESSION_IDENTIFIER:
+        fprintf(fp, STR_FMT, STR_ARG(ast_name(ast, e->a)));
+        break;
+    case EXPRESSION_INT_LITERAL:
+    case EXPRESSION_FLOAT_LITERAL:
+    case EXPRESSION_CHAR_LITERAL:
+    case EXPRESSION_STRING_LITERAL:
+        fprintf(fp, STR_FMT, STR_ARG(ast_name(ast, e->c)));
+        break;
+    case EXPRESSION_UNARY:
+    case EXPRESSION_POSTFIX:
+        fprintf(fp, "(%s%s ", ast->expression_tags.items[index] == EXPRESSION_POSTFIX ? "post" : "", dfa_spelling[e->op]);
+        ast_fprint_expression(fp, ast, e->a);
+        fprintf(fp, ")");
+        break;
+    case EXPRESSION_BINARY:
+    case EXPRESSION_ASSIGN:
+        fprintf(fp, "(%s ", e->op == TOK_OPEN_BRACKET ? "[]" : dfa_spelling[e->op]);
+        ast_fprint_expression(fp, ast, e->a);
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, e->b);
+        fprintf(fp, ")");
+        break;
+    case EXPRESSION_CONDITIONAL:
+        fprintf(fp, "(? ");
+        ast_fprint_expression(fp, ast, e->a);
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, e->b);
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, e->c);
+        fprintf(fp, ")");
+        break;
+    case EXPRESSION_CALL:
+        fprintf(fp, "(call ");
+        ast_fprint_expression(fp, ast, e->a);
+        for(i = 0; i < e->c; ++i) {
+            fprintf(fp, " ");
+            ast_fprint_expression(fp, ast, ast->lists.items[e->b + i]);
+        }
+        fprintf(fp, ")");
+        break;
+    case EXPRESSION_MEMBER:
+        fprintf(fp, "(%s ", dfa_spelling[e->op]);
+        ast_fprint_expression(fp, ast, e->a);
+        fprintf(fp, " " STR_FMT ")", STR_ARG(ast_name(ast, e->b)));
+        break;
+    case EXPRESSION_CAST:
+        fprintf(fp, "(cast ");
+        ast_fprint_type(fp, ast, e->b);
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, e->a);
+        fprintf(fp, ")");
+        break;
+    case EXPRESSION_SIZEOF_TYPE:
+        fprintf(fp, "(sizeof ");
+        ast_fprint_type(fp, ast, e->b);
+        fprintf(fp, ")");
+        break;
+    }
+}
+
+void ast_fprint_statement(FILE * fp, const Ast * ast, AstIndex index, unsigned int indent) {
+    static const char * const names[] = {
+        "return", "expression", "declaration", "compound", "if", "while", "do", "for",
+        "switch", "case", "default", "label", "goto", "break", "continue", "empty", "typedef",
+        "static declaration", "extern declaration"
+    };
+    const StatementTag tag = (StatementTag)ast->statement_tags.items[index];
+    const AstStatement * st = &ast->statements.items[index];
+    unsigned int i;
+    fprintf(fp, "%*s(%s", (int)indent * 2, "", names[tag]);
+    switch(tag) {
+    case STATEMENT_RETURN:
+    case STATEMENT_EXPRESSION:
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, st->a);
+        break;
+    case STATEMENT_DECLARATION:
+    case STATEMENT_TYPEDEF:
+    case STATEMENT_STATIC:
+    case STATEMENT_EXTERN:
+        fprintf(fp, " ");
+        ast_fprint_type(fp, ast, st->a);
+        fprintf(fp, " " STR_FMT, STR_ARG(ast_name(ast, st->b)));
+        if(tag != STATEMENT_TYPEDEF) {
+            fprintf(fp, " ");
+            ast_fprint_expression(fp, ast, st->c);
+        }
+        break;
+    case STATEMENT_COMPOUND:
+        for(i = 0; i < st->b; ++i) {
+            fprintf(fp, "\n");
+            ast_fprint_statement(fp, ast, ast->lists.items[st->a + i], indent + 1);
+        }
+        break;
+    case STATEMENT_IF:
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, st->a);
+        fprintf(fp, "\n");
+        ast_fprint_statement(fp, ast, st->b, indent + 1);
+        if(st->c) {
+            fprintf(fp, "\n");
+            ast_fprint_statement(fp, ast, st->c, indent + 1);
+        }
+        break;
+    case STATEMENT_WHILE:
+    case STATEMENT_DO:
+    case STATEMENT_SWITCH:
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, st->a);
+        fprintf(fp, "\n");
+        ast_fprint_statement(fp, ast, st->b, indent + 1);
+        break;
+    case STATEMENT_FOR:
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, st->a);
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, st->b);
+        fprintf(fp, " ");
+        ast_fprint_expression(fp, ast, st->c);
+        fprintf(fp, "\n");
+        ast_fprint_statement(fp, ast, st->d, indent + 1);
+        break;
+    case STATEMENT_CASE:
+    case STATEMENT_DEFAULT:
+    case STATEMENT_LABEL:
+        if(tag == STATEMENT_CASE) {
+            fprintf(fp, " ");
+            ast_fprint_expression(fp, ast, st->a);
+        } else if(tag == STATEMENT_LABEL) {
+            fprintf(fp, " " STR_FMT, STR_ARG(ast_name(ast, st->a)));
+        }
+        fprintf(fp, "\n");
+        ast_fprint_statement(fp, ast, st->b, indent + 1);
+        break;
+    case STATEMENT_GOTO:
+        fprintf(fp, " " STR_FMT, STR_ARG(ast_name(ast, st->a)));
+        break;
+    default:
+        break;
+    }
+    fprintf(fp, ")");
+}
+
+void toplevel_fprint(FILE * fp, const Ast * ast, const Toplevel * t) {
+    static const char * const storage[] = {"", "static ", "extern "};
+    const FunctionPrototype * prototype = &t->as.function_definition.prototype;
+    unsigned int i;
+    if(t->tag == TOPLEVEL_DECLARATION || t->tag == TOPLEVEL_TYPEDEF) {
+        fprintf(fp, "(%s%s ", storage[t->storage], t->tag == TOPLEVEL_TYPEDEF ? "typedef" : "declaration");
+        ast_fprint_type(fp, ast, t->as.declaration.type);
+        fprintf(fp, " " STR_FMT, STR_ARG(ast_name(ast, t->as.declaration.name)));
+        if(t->tag == TOPLEVEL_DECLARATION) {
+            fprintf(fp, " ");
+            ast_fprint_expression(fp, ast, t->as.declaration.init);
+        }
+        fprintf(fp, ")\n");
+        return;
+    }
+    fprintf(fp, "(%sfunction ", storage[t->storage]);
+    ast_fprint_type(fp, ast, prototype->return_type);
+    fprintf(fp, " " STR_FMT " (", STR_ARG(ast_name(ast, prototype->name)));
+    for(i = 0; i < prototype->parameter_count; ++i) {
+        const FunctionParameter * param = &ast->parameters.items[prototype->first_parameter + i];
+        if(i > 0) fprintf(fp, " ");
+        ast_fprint_type(fp, ast, param->type);
+        if(param->name) fprintf(fp, " " STR_FMT, STR_ARG(ast_name(ast, param->name)));
+    }
+    fprintf(fp, ")");
+    if(t->as.function_definition.body) {
+        const AstStatement * body = &ast->statements.items[t->as.function_definition.body];
+        for(i = 0; i < body->b; ++i) {
+            fprintf(fp, "\n");
+            ast_fprint_statement(fp, ast, ast->lists.items[body->a + i], 1);
+        }
+    }
+    fprintf(fp, ")\n");
+}
+
+/**** CONSTANT EXPRESSIONS ****/
+
+/*The width and signedness of an integer type, false for other types*/
+core_Bool ast_integer_type(const Ast * ast, AstIndex type, unsigned int * bits, core_Bool * is_unsigned) {
+    if(type == 0) return CORE_FALSE;
+    switch(ast->types.items[ast->types.items[type].canonical].tag) {
+    case TYPE_CHAR: case TYPE_SIGNED_CHAR: *bits = TARGET_CHAR_BITS; *is_unsigned = CORE_FALSE; return CORE_TRUE;
+    case TYPE_UNSIGNED_CHAR: *bits = TARGET_CHAR_BITS; *is_unsigned = CORE_TRUE; return CORE_TRUE;
+    case TYPE_SHORT: *bits = TARGET_SHORT_BITS; *is_unsigned = CORE_FALSE; return CORE_TRUE;
+    case TYPE_UNSIGNED_SHORT: *bits = TARGET_SHORT_BITS; *is_unsigned = CORE_TRUE; return CORE_TRUE;
+    case TYPE_INT: *bits = TARGET_INT_BITS; *is_unsigned = CORE_FALSE; return CORE_TRUE;
+    case TYPE_UNSIGNED_INT: *bits = TARGET_INT_BITS; *is_unsigned = CORE_TRUE; return CORE_TRUE;
+    case TYPE_LONG: *bits = TARGET_LONG_BITS; *is_unsigned = CORE_FALSE; return CORE_TRUE;
+    case TYPE_UNSIGNED_LONG: *bits = TARGET_LONG_BITS; *is_unsigned = CORE_TRUE; return CORE_TRUE;
+    default: return CORE_FALSE;
+    }
+}
+
+/*sizeof of a type in bytes, 0 if it is not known or has no size*/
+unsigned long ast_type_size(const Ast * ast, AstIndex type) {
+    if(type == 0) return 0;
+    switch(ast->types.items[ast->types.items[type].canonical].tag) {
+    case TYPE_CHAR: case TYPE_SIGNED_CHAR: case TYPE_UNSIGNED_CHAR: return TARGET_CHAR_BITS / 8;
+    case TYPE_SHORT: case TYPE_UNSIGNED_SHORT: return TARGET_SHORT_BITS / 8;
+    case TYPE_INT: case TYPE_UNSIGNED_INT: case TYPE_FLOAT: return TARGET_INT_BITS / 8;
+    case TYPE_LONG_DOUBLE: return 16;
+    case TYPE_VOID: case TYPE_FUNCTION: return 0;
+    default: return TARGET_LONG_BITS / 8;
+    }
+}
+
+/*The type of an expression, 0 if the semantic pass has not given it one*/
+#define ast_expression_type(ast, index) ((index) < (ast)->expression_types.len ? (ast)->expression_types.items[index] : 0)
+
+/*Evaluates an integer constant expression: literals, sizeof, casts to
+  integer types and the arithmetic, bitwise, relational, logical and
+  conditional operators on those. sizeof of an expression needs the types
+  of the semantic pass. Like #if, an operand that is not evaluated, the
+  right of a decided && or || or the arm of ?: not taken, must still be
+  constant but dividing by zero in it is no error: `dead` is set inside one*/
+ConstStatus ast_eval_constant_in(const Ast * ast, AstIndex index, core_Bool dead, ConstValue * out) {
+    static const unsigned char literal_bits[] = {TARGET_INT_BITS, TARGET_INT_BITS, TARGET_LONG_BITS, TARGET_LONG_BITS};
+    const AstExpression * e = &ast->expressions.items[index];
+    ConstValue lhs, rhs, cond;
+    ConstStatus status;
+    unsigned int bits;
+    core_Bool is_unsigned;
+    unsigned long size;
+    if(index == 0) return CONST_NOT_CONSTANT;
+    switch((ExpressionTag)ast->expression_tags.items[index]) {
+    case EXPRESSION_INT_LITERAL:
+        *out = const_make(ast->values.items[e->a], literal_bits[e->b], e->b == INT_LITERAL_UNSIGNED_INT || e->b == INT_LITERAL_UNSIGNED_LONG);
+        return CONST_OK;
+    case EXPRESSION_CHAR_LITERAL:
+        *out = const_int(char_literal_value(ast_name(ast, e->c)));
+        return CONST_OK;
+    case EXPRESSION_SIZEOF_TYPE:
+        size = ast_type_size(ast, e->b);
+        *out = const_make(size, TARGET_LONG_BITS, CORE_TRUE);
+        return size ? CONST_OK : CONST_NOT_CONSTANT;
+    case EXPRESSION_UNARY:
+        if(e->op == TOK_SIZEOF) {
+            size = ast_type_size(ast, ast_expression_type(ast, e->a));
+            *out = const_make(size, TARGET_LONG_BITS, CORE_TRUE);
+            return size ? CONST_OK : CONST_NOT_CONSTANT;
+        }
+        if(e->op != TOK_PLUS && e->op != TOK_MINUS && e->op != TOK_TILDE && e->op != TOK_BANG) return CONST_NOT_CONSTANT;
+        if((status = ast_eval_constant_in(ast, e->a, dead, &lhs)) != CONST_OK) return status;
+        *out = const_unary((TokenTag)e->op, lhs);
+        return CONST_OK;
+    case EXPRESSION_BINARY:
+        if(e->op == TOK_COMMA || e->op == TOK_OPEN_BRACKET) return CONST_NOT_CONSTANT;
+        if((status = ast_eval_constant_in(ast, e->a, dead, &lhs)) != CONST_OK) return status;
+        if(e->op == TOK_AND_AND || e->op == TOK_OR_OR) {
+            const core_Bool decided = (e->op == TOK_AND_AND) == !lhs.value;
+            status = ast_eval_constant_in(ast, e->b, dead || decided, &rhs);
+        } else {
+            status = ast_eval_constant_in(ast, e->b, dead, &rhs);
+        }
+        if(status != CONST_OK) return status;
+        status = const_binary((TokenTag)e->op, lhs, rhs, out);
+        return status == CONST_DIVISION_BY_ZERO && dead ? CONST_OK : status;
+    case EXPRESSION_CONDITIONAL:
+        if((status = ast_eval_constant_in(ast, e->a, dead, &cond)) != CONST_OK) return status;
+        if((status = ast_eval_constant_in(ast, e->b, dead || !cond.value, &lhs)) != CONST_OK) return status;
+        if((status = ast_eval_constant_in(ast, e->c, dead || cond.value, &rhs)) != CONST_OK) return status;
+        lhs = const_promote(lhs);
+        rhs = const_promote(rhs);
+        const_convert_common(&lhs, &rhs);
+        *out = cond.value ? lhs : rhs;
+        return CONST_OK;
+    case EXPRESSION_CAST:
+        if(!ast_integer_type(ast, e->b, &bits, &is_unsigned)) return CONST_NOT_CONSTANT;
+        if((status = ast_eval_constant_in(ast, e->a, dead, &lhs)) != CONST_OK) return status;
+        *out = const_make(lhs.value, bits, is_unsigned);
+        return CONST_OK;
+    default:
+        return CONST_NOT_CONSTANT;
+    }
+}
+
+#define ast_eval_constant(ast, index, out) ast_eval_constant_in(ast, index, CORE_FALSE, out)
+
+#define ast_is_literal(ast, index) \
+    ((ast)->expression_tags.items[index] == EXPRESSION_INT_LITERAL || (ast)->expression_tags.items[index] == EXPRESSION_CHAR_LITERAL)
+
+/*Whether the operands the expression evaluates are all literals, so it is
+  constant if it is one of the operators ast_eval_constant knows*/
+core_Bool ast_operands_are_literals(const Ast * ast, AstIndex index) {
+    const AstExpression * e = &ast->expressions.items[index];
+    switch((ExpressionTag)ast->expression_tags.items[index]) {
+    case EXPRESSION_UNARY:
+        return e->op == TOK_SIZEOF || ast_is_literal(ast, e->a);
+    case EXPRESSION_CAST:
+        return ast_is_literal(ast, e->a);
+    case EXPRESSION_BINARY:
+        return ast_is_literal(ast, e->a) && ast_is_literal(ast, e->b);
+    case EXPRESSION_CONDITIONAL:
+        return ast_is_literal(ast, e->a) && ast_is_literal(ast, e->b) && ast_is_literal(ast, e->c);
+    case EXPRESSION_SIZEOF_TYPE:
+        return CORE_TRUE;
+    default:
+        return CORE_FALSE;
+    }
+}
+
+/*Whether the expression is the integer literal `value`*/
+core_Bool ast_is_int_literal(const Ast * ast, AstIndex index, unsigned long value) {
+    return ast->expression_tags.items[index] == EXPRESSION_INT_LITERAL && ast->values.items[ast->expressions.items[index].a] == value;
+}
+
+/*The operand that `x op 0`, `x * 1` and the like leave as they are, 0 if
+  there is none. Only for integers: x + 0 is not x for a double x of -0.0*/
+AstIndex ast_identity_operand(const Ast * ast, AstIndex index) {
+    const AstExpression * e = &ast->expressions.items[index];
+    AstIndex x = 0;
+    unsigned int bits;
+    core_Bool is_unsigned;
+    if(ast->expression_tags.items[index] != EXPRESSION_BINARY) return 0;
+    switch(e->op) {
+    case TOK_PLUS: case TOK_PIPE: case TOK_CARET:
+        x = ast_is_int_literal(ast, e->b, 0) ? e->a : ast_is_int_literal(ast, e->a, 0) ? e->b : 0;
+        break;
+    case TOK_MINUS: case TOK_SHL: case TOK_SHR:
+        x = ast_is_int_literal(ast, e->b, 0) ? e->a : 0;
+        break;
+    case TOK_STAR:
+        x = ast_is_int_literal(ast, e->b, 1) ? e->a : ast_is_int_literal(ast, e->a, 1) ? e->b : 0;
+        break;
+    case TOK_SLASH:
+        x = ast_is_int_literal(ast, e->b, 1) ? e->a : 0;
+        break;
+    default:
+        break;
+    }
+    /*the operand must already have the type of the result, so nothing is converted*/
+    if(x == 0 || ast->expression_types.items[x] != ast->expression_types.items[index]) return 0;
+    return ast_integer_type(ast, ast->expression_types.items[x], &bits, &is_unsigned) ? x : 0;
+}
+
+/*Replaces the expression by the literal of its value if it is constant*/
+void ast_fold_expression(Ast * ast, core_Arena * a, AstIndex index) {
+    static const char * const suffixes[] = {"", "u", "l", "ul"};
+    AstExpression * e = &ast->expressions.items[index];
+    ConstValue v;
+    IntLiteralType type;
+    char spelling[32];
+    Str text;
+    if(ast_eval_constant(ast, index, &v) != CONST_OK) return;
+    /*only an int or a long can be written as a literal, a cast to char stays*/
+    if(!ast_integer_type(ast, ast->expression_types.items[index], &v.bits, &v.is_unsigned) || v.bits < TARGET_INT_BITS) return;
+    v = const_make(v.value, v.bits, v.is_unsigned);
+    type = v.bits == TARGET_INT_BITS ? (v.is_unsigned ? INT_LITERAL_UNSIGNED_INT : INT_LITERAL_INT)
+                                     : (v.is_unsigned ? INT_LITERAL_UNSIGNED_LONG : INT_LITERAL_LONG);
+    if(v.is_unsigned) sprintf(spelling, "%lu%s", v.value, suffixes[type]);
+    else sprintf(spelling, "%ld%s", (long)v.value, suffixes[type]);
+    text.ptr = spelling;
+    text.len = strlen(spelling);
+    core_vec_append(&ast->values, a, v.value);
+    e->a = ast->values.len - 1;
+    e->b = type;
+    e->c = ast_intern(ast, a, text);
+    ast->expression_tags.items[index] = EXPRESSION_INT_LITERAL;
+}
+
+/*Replaces every constant subtree by the literal of its value and drops
+  operations that leave their operand as it is, such as x + 0. Children
+  come before their parents in Ast.expressions, so one walk in order
+  folds from the leaves up and a parent only has to look at its direct
+  operands. A case label can be constant without its operands folding,
+  as in `1 ? 2 : 1/0`, and is folded as a whole. Runs after the semantic
+  pass, which it needs the types of and whose checks saw the tree
+  unfolded. The nodes folded away stay in the arrays, no longer
+  referenced*/
+void ast_fold_constants(Ast * ast, core_Arena * a) {
+    unsigned int i;
+    for(i = 1; i < ast->expressions.len && i < ast->expression_types.len; ++i) {
+        AstExpression * e = &ast->expressions.items[i];
+        const AstIndex x = ast_identity_operand(ast, i);
+        if(x != 0) {
+            *e = ast->expressions.items[x];
+            ast->expression_tags.items[i] = ast->expression_tags.items[x];
+        } else if(ast_operands_are_literals(ast, i)) {
+            ast_fold_expression(ast, a, i);
+        }
+    }
+    for(i = 1; i < ast->statements.len; ++i) {
+        const AstIndex value = ast->statements.items[i].a;
+        if(ast->statement_tags.items[i] == STATEMENT_CASE && value < ast->expression_types.len && !ast_is_literal(ast, value)) {
+            ast_fold_expression(ast, a, value);
+        }
+    }
+}
+
+/**** SEMANTIC ANALYSIS ****/
+
+/*One walk over the toplevels in source order, which is the order C
+  scopes names in, so every name is declared by the time it is used. The
+  symbol each Ast name is bound to is an array load, and every binding is
+  logged so leaving a scope undoes it, like the typedef table of the
+  parser. Identifiers and declarations are given their symbol and every
+  expression its type, so later passes never look a name up again*/
+typedef struct {
+    AstIndex name;
+    AstIndex was;
+} SymbolBinding;
+
+typedef struct {
+    Ast * ast;
+    core_Arena * arena;
+    Diagnostics * diag;
+    Toplevels * toplevels;
+    core_Vec(AstIndex) bindings; /*the symbol of each Ast name in scope, 0 if none*/
+    core_Vec(SymbolBinding) log;
+    AstIndex scope_first; /*symbols from here on are in the innermost scope*/
+    core_Bool in_function;
+    AstIndex return_type; /*of the current function*/
+    unsigned int frame_size; /*slots given out in the current function*/
+} Sema;
+
+#define sema_basic_type(s, tag) ast_type((s)->ast, (s)->arena, tag, 0, 0)
+#define sema_is_integer(tag) ((tag) <= TYPE_UNSIGNED_LONG)
+#define sema_is_arithmetic(tag) ((tag) <= TYPE_LONG_DOUBLE)
+#define sema_is_scalar(tag) (sema_is_arithmetic(tag) || (tag) == TYPE_POINTER)
+
+/*The tag of a known type with its typedef names resolved*/
+TypeSpecifierTag sema_tag(const Sema * s, AstIndex type) {
+    return s->ast->types.items[s->ast->types.items[type].canonical].tag;
+}
+
+/*The type `type` points to, 0 if it is not a known pointer*/
+AstIndex sema_pointee(const Sema * s, AstIndex type) {
+    if(type == 0 || sema_tag(s, type) != TYPE_POINTER) return 0;
+    return s->ast->types.items[s->ast->types.items[type].canonical].base;
+}
+
+/*The usual arithmetic conversions: char is promoted to int and the
+  operand of lower rank is converted to the other. A long and an unsigned
+  int make a long if long is the wider, see CONSTANT ARITHMETIC. 0 if
+  either type is unknown or not arithmetic*/
+AstIndex sema_arithmetic(Sema * s, AstIndex lhs, AstIndex rhs) {
+    TypeSpecifierTag l, r;
+    if(lhs == 0 || rhs == 0) return 0;
+    l = sema_tag(s, lhs);
+    r = sema_tag(s, rhs);
+    if(!sema_is_arithmetic(l) || !sema_is_arithmetic(r)) return 0;
+    if(TARGET_LONG_BITS == TARGET_INT_BITS && CORE_MIN(l, r) == TYPE_UNSIGNED_INT && CORE_MAX(l, r) == TYPE_LONG) {
+        return sema_basic_type(s, TYPE_UNSIGNED_LONG);
+    }
+    return sema_basic_type(s, (TypeSpecifierTag)CORE_MAX(CORE_MAX(l, r), TYPE_INT));
+}
+
+/*sema_arithmetic for the operators only defined on integers*/
+AstIndex sema_integer(Sema * s, AstIndex lhs, AstIndex rhs) {
+    if(lhs == 0 || rhs == 0 || !sema_is_integer(sema_tag(s, lhs)) || !sema_is_integer(sema_tag(s, rhs))) return 0;
+    return sema_arithmetic(s, lhs, rhs);
+}
+
+/*Whether the expression, already typed, is a null pointer constant: an
+  integer constant expression that is 0*/
+core_Bool sema_is_null_pointer(const Sema * s, AstIndex index) {
+    ConstValue v;
+    unsigned int bits;
+    core_Bool is_unsigned;
+    return ast_integer_type(s->ast, s->ast->expression_types.items[index], &bits, &is_unsigned)
+        && ast_eval_constant(s->ast, index, &v) == CONST_OK && v.value == 0;
+}
+
+/*Whether two pointer types can be compared, or one converted to the
+  other: they point to the same type or one of them is a void pointer*/
+core_Bool sema_pointers_agree(const Sema * s, AstIndex lhs, AstIndex rhs) {
+    return ast_same_type(s->ast, lhs, rhs)
+        || sema_tag(s, sema_pointee(s, lhs)) == TYPE_VOID || sema_tag(s, sema_pointee(s, rhs)) == TYPE_VOID;
+}
+
+/*Whether `value`, of type `from`, can be assigned to an object of type
+  `to`: arithmetic to arithmetic, a pointer to an agreeing pointer and a
+  null pointer constant to any pointer. Unknown types were reported
+  already and agree with anything*/
+core_Bool sema_assignable(const Sema * s, AstIndex to, AstIndex from, AstIndex value) {
+    TypeSpecifierTag t, f;
+    if(to == 0 || from == 0) return CORE_TRUE;
+    t = sema_tag(s, to);
+    f = sema_tag(s, from);
+    if(sema_is_arithmetic(t)) return sema_is_arithmetic(f);
+    if(t != TYPE_POINTER) return CORE_FALSE;
+    return (f == TYPE_POINTER && sema_pointers_agree(s, to, from)) || sema_is_null_pointer(s, value);
+}
+
+/*The type of `lhs op rhs`, the operands being the expressions a and b,
+  0 if the operator does not take them or either type is unknown*/
+AstIndex sema_binary(Sema * s, TokenTag op, AstIndex a, AstIndex lhs, AstIndex b, AstIndex rhs) {
+    AstIndex lp, rp;
+    if(op == TOK_COMMA) return rhs;
+    if(lhs == 0 || rhs == 0) return 0;
+    lp = sema_pointee(s, lhs);
+    rp = sema_pointee(s, rhs);
+    switch(op) {
+    case TOK_OPEN_BRACKET:
+        return lp && sema_is_integer(sema_tag(s, rhs)) ? lp : rp && sema_is_integer(sema_tag(s, lhs)) ? rp : 0;
+    case TOK_AND_AND:
+    case TOK_OR_OR:
+        return sema_is_scalar(sema_tag(s, lhs)) && sema_is_scalar(sema_tag(s, rhs)) ? sema_basic_type(s, TYPE_INT) : 0;
+    case TOK_EQ_EQ: case TOK_NOT_EQ: case TOK_LT: case TOK_GT: case TOK_LE: case TOK_GE:
+        if(sema_arithmetic(s, lhs, rhs) || (lp && rp && sema_pointers_agree(s, lhs, rhs))
+           || (lp && sema_is_null_pointer(s, b)) || (rp && sema_is_null_pointer(s, a))) {
+            return sema_basic_type(s, TYPE_INT);
+        }
+        return 0;
+    case TOK_SHL:
+    case TOK_SHR:
+        return sema_integer(s, lhs, rhs) ? sema_arithmetic(s, lhs, lhs) : 0;
+    case TOK_PERCENT: case TOK_AMPERSAND: case TOK_PIPE: case TOK_CARET:
+        return sema_integer(s, lhs, rhs);
+    case TOK_PLUS:
+        if(lp) return sema_is_integer(sema_tag(s, rhs)) ? lhs : 0;
+        if(rp) return sema_is_integer(sema_tag(s, lhs)) ? rhs : 0;
+        return sema_arithmetic(s, lhs, rhs);
+    case TOK_MINUS:
+        if(lp && rp) return ast_same_type(s->ast, lhs, rhs) ? sema_basic_type(s, TYPE_LONG) : 0;
+        if(lp) return sema_is_integer(sema_tag(s, rhs)) ? lhs : 0;
+        return sema_arithmetic(s, lhs, rhs);
+    default:
+        return sema_arithmetic(s, lhs, rhs);
+    }
+}
+
+/*The operator a compound assignment applies*/
+TokenTag sema_compound_operator(TokenTag op) {
+    switch(op) {
+    case TOK_PLUS_ASSIGN: return TOK_PLUS;
+    case TOK_MINUS_ASSIGN: return TOK_MINUS;
+    case TOK_STAR_ASSIGN: return TOK_STAR;
+    case TOK_SLASH_ASSIGN: return TOK_SLASH;
+    case TOK_PERCENT_ASSIGN: return TOK_PERCENT;
+    case TOK_SHL_ASSIGN: return TOK_SHL;
+    case TOK_SHR_ASSIGN: return TOK_SHR;
+    case TOK_AND_ASSIGN: return TOK_AMPERSAND;
+    case TOK_XOR_ASSIGN: return TOK_CARET;
+    default: return TOK_PIPE;
+    }
+}
+
+/*Whether a cast from `from` to `to` is allowed: anything to void, and
+  between scalars except a pointer to or from a floating type*/
+core_Bool sema_castable(const Sema * s, AstIndex to, AstIndex from) {
+    TypeSpecifierTag t, f;
+    if(to == 0 || from == 0) return CORE_TRUE;
+    t = sema_tag(s, to);
+    f = sema_tag(s, from);
+    if(t == TYPE_VOID) return CORE_TRUE;
+    if(t == TYPE_POINTER) return f == TYPE_POINTER || sema_is_integer(f);
+    if(sema_is_integer(t)) return sema_is_scalar(f);
+    return sema_is_arithmetic(t) && sema_is_arithmetic(f);
+}
+
+void sema_report_operands(Sema * s, SrcLoc loc, TokenTag op) {
+    Str spelling;
+    spelling.ptr = op == TOK_OPEN_BRACKET ? "[]" : dfa_spelling[op];
+    spelling.len = strlen(spelling.ptr);
+    diag_report_str(s->diag, loc, "Invalid operands to", spelling);
+}
+
+/*Whether the functions declared by two toplevels take the same
+  parameters. One declared f() agrees with any*/
+core_Bool sema_prototypes_agree(const Sema * s, AstIndex lhs, AstIndex rhs) {
+    const FunctionPrototype * l = &s->toplevels->items[lhs].as.function_definition.prototype;
+    const FunctionPrototype * r = &s->toplevels->items[rhs].as.function_definition.prototype;
+    unsigned int i;
+    if(l->unspecified || r->unspecified) return CORE_TRUE;
+    if(l->parameter_count != r->parameter_count) return CORE_FALSE;
+    for(i = 0; i < l->parameter_count; ++i) {
+        const AstIndex lt = s->ast->parameters.items[l->first_parameter + i].type;
+        const AstIndex rt = s->ast->parameters.items[r->first_parameter + i].type;
+        if(!ast_same_type(s->ast, lt, rt)) return CORE_FALSE;
+    }
+    return CORE_TRUE;
+}
+
+/*Whether the toplevel declaration defines what it declares*/
+core_Bool sema_defines(const Sema * s, SymbolKind kind, AstIndex declaration) {
+    const Toplevel * t = &s->toplevels->items[declaration];
+    if(kind == SYMBOL_FUNCTION) return t->as.function_definition.body != 0 || t->as.function_definition.skipped_count != 0;
+    return kind == SYMBOL_GLOBAL && t->as.declaration.init != 0;
+}
+
+/*Binds `name` to a new symbol to the end of the current scope. A file
+  scope name declared again must agree with the earlier declarations, and
+  be defined at most once*/
+AstIndex sema_declare(Sema * s, SymbolKind kind, AstIndex name, AstIndex type, AstIndex declaration, SrcLoc loc) {
+    Ast * ast = s->ast;
+    const AstIndex previous = s->bindings.items[name];
+    AstSymbol sym;
+    SymbolBinding binding;
+    memset(&sym, 0, sizeof(sym));
+    sym.declaration = declaration;
+    sym.defined = (kind == SYMBOL_FUNCTION || kind == SYMBOL_GLOBAL) && sema_defines(s, kind, declaration);
+    if(kind != SYMBOL_TYPEDEF && kind != SYMBOL_FUNCTION && type != 0 && sema_tag(s, type) == TYPE_VOID) {
+        diag_report_str(s->diag, loc, "Declared with type void", ast_name(ast, name));
+    }
+    if(previous >= s->scope_first) {
+        /*file scope names may be declared again if the declarations agree*/
+        const AstSymbol * other = &ast->symbols.items[previous];
+        if(s->in_function) {
+            diag_report_str(s->diag, loc, "Redeclared in the same scope", ast_name(ast, name));
+        } else if(other->kind != kind || kind == SYMBOL_TYPEDEF || !ast_same_type(ast, other->type, type)
+                  || (kind == SYMBOL_FUNCTION && !sema_prototypes_agree(s, other->declaration, declaration))) {
+            diag_report_str(s->diag, loc, "Conflicting declarations", ast_name(ast, name));
+        } else {
+            if(sym.defined && other->defined) diag_report_str(s->diag, loc, "Redefinition", ast_name(ast, name));
+            sym.defined = sym.defined || other->defined;
+            /*calls are checked against the parameters of the declaration that gives them*/
+            if(kind == SYMBOL_FUNCTION && s->toplevels->items[declaration].as.function_definition.prototype.unspecified) {
+                sym.declaration = other->declaration;
+            }
+        }
+    }
+    sym.kind = kind;
+    sym.name = name;
+    sym.type = type;
+    sym.slot = kind == SYMBOL_PARAMETER || kind == SYMBOL_LOCAL ? s->frame_size++ : 0;
+    core_vec_append(&ast->symbols, s->arena, sym);
+    binding.name = name;
+    binding.was = previous;
+    core_vec_append(&s->log, s->arena, binding);
+    s->bindings.items[name] = ast->symbols.len - 1;
+    return ast->symbols.len - 1;
+}
+
+/*Undoes the bindings logged since the log was `mark` entries long*/
+void sema_leave_scope(Sema * s, unsigned int mark, AstIndex scope_first) {
+    while(s->log.len > mark) {
+        const SymbolBinding binding = s->log.items[--s->log.len];
+        s->bindings.items[binding.name] = binding.was;
+    }
+    s->scope_first = scope_first;
+}
+
+core_Bool sema_is_lvalue(const Sema * s, AstIndex index) {
+    const AstExpression * e = &s->ast->expressions.items[index];
+    switch((ExpressionTag)s->ast->expression_tags.items[index]) {
+    case EXPRESSION_IDENTIFIER:
+        /*an undeclared one was reported already*/
+        return e->b == 0 || s->ast->symbols.items[e->b].kind != SYMBOL_FUNCTION;
+    case EXPRESSION_UNARY:
+        return e->op == TOK_STAR;
+    case EXPRESSION_BINARY:
+        return e->op == TOK_OPEN_BRACKET;
+    case EXPRESSION_MEMBER:
+        return CORE_TRUE;
+    default:
+        return CORE_FALSE;
+    }
+}
+
+void sema_expect_lvalue(Sema * s, AstIndex index, SrcLoc loc) {
+    if(!sema_is_lvalue(s, index)) diag_report(s->diag, loc, "Expression is not assignable");
+}
+
+/*Checks the call `e`, its callee and arguments already checked, and
+  returns its type. The callee is a function or a pointer to one*/
+AstIndex sema_call(Sema * s, const AstExpression * e, AstIndex callee_type) {
+    const Ast * ast = s->ast;
+    const AstExpression * callee = &ast->expressions.items[e->a];
+    const AstSymbol * sym;
+    const FunctionPrototype * prototype;
+    AstIndex function = callee_type;
+    unsigned int i;
+    if(callee_type == 0) return 0;
+    if(sema_pointee(s, function)) function = sema_pointee(s, function);
+    if(sema_tag(s, function) != TYPE_FUNCTION) {
+        if(ast->expression_tags.items[e->a] == EXPRESSION_IDENTIFIER) {
+            diag_report_str(s->diag, e->loc, "Called object is not a function", ast_name(ast, callee->a));
+        } else {
+            diag_report(s->diag, e->loc, "Called object is not a function");
+        }
+        return 0;
+    }
+    if(ast->expression_tags.items[e->a] != EXPRESSION_IDENTIFIER || ast->symbols.items[callee->b].kind != SYMBOL_FUNCTION) {
+        return ast->types.items[function].base;
+    }
+    /*f() says nothing of the arguments a call takes*/
+    sym = &ast->symbols.items[callee->b];
+    prototype = &s->toplevels->items[sym->declaration].as.function_definition.prototype;
+    if(!prototype->unspecified && prototype->parameter_count != e->c) {
+        diag_report_str(s->diag, e->loc, "Wrong number of arguments to", ast_name(ast, sym->name));
+    }
+    for(i = 0; i < e->c && i < prototype->parameter_count; ++i) {
+        const AstIndex argument = ast->lists.items[e->b + i];
+        if(!sema_assignable(s, ast->parameters.items[prototype->first_parameter + i].type, ast->expression_types.items[argument], argument)) {
+            diag_report_str(s->diag, ast->expressions.items[argument].loc, "Incompatible argument to", ast_name(ast, sym->name));
+        }
+    }
+    return prototype->return_type;
+}
+
+void sema_condition(Sema * s, AstIndex index);
+
+/*Resolves the names in the expression and returns its type, which is
+  also stored in Ast.expression_types*/
+AstIndex sema_expression(Sema * s, AstIndex index) {
+    static const TypeSpecifierTag literal_types[] = {TYPE_INT, TYPE_UNSIGNED_INT, TYPE_LONG, TYPE_UNSIGNED_LONG};
+    Ast * ast = s->ast;
+    AstExpression * e = &ast->expressions.items[index];
+    AstIndex type = 0;
+    AstIndex lhs, rhs;
+    unsigned int i;
+    if(index == 0) return 0;
+    switch((ExpressionTag)ast->expression_tags.items[index]) {
+    case EXPRESSION_IDENTIFIER:
+        e->b = s->bindings.items[e->a];
+        if(e->b != 0) type = ast->symbols.items[e->b].type;
+        else diag_report_str(s->diag, e->loc, "Undeclared identifier", ast_name(ast, e->a));
+        break;
+    case EXPRESSION_INT_LITERAL:
+        type = sema_basic_type(s, literal_types[e->b]);
+        break;
+    case EXPRESSION_FLOAT_LITERAL:
+        type = sema_basic_type(s, TYPE_DOUBLE);
+        break;
+    case EXPRESSION_CHAR_LITERAL:
+        type = sema_basic_type(s, TYPE_INT);
+        break;
+    case EXPRESSION_STRING_LITERAL:
+        type = ast_type(ast, s->arena, TYPE_POINTER, 0, sema_basic_type(s, TYPE_CHAR));
+        break;
+    case EXPRESSION_UNARY:
+        lhs = sema_expression(s, e->a);
+        switch(e->op) {
+        case TOK_AMPERSAND:
+            /*a function is not an lvalue, but has an address*/
+            if(lhs == 0 || sema_tag(s, lhs) != TYPE_FUNCTION) sema_expect_lvalue(s, e->a, e->loc);
+            if(lhs) type = ast_type(ast, s->arena, TYPE_POINTER, 0, lhs);
+            break;
+        case TOK_STAR:
+            type = lhs && sema_tag(s, lhs) == TYPE_FUNCTION ? lhs : sema_pointee(s, lhs);
+            if(lhs && !type) diag_report(s->diag, e->loc, "Dereferenced value is not a pointer");
+            break;
+        case TOK_PLUS_PLUS:
+        case TOK_MINUS_MINUS:
+            sema_expect_lvalue(s, e->a, e->loc);
+            type = lhs && sema_is_scalar(sema_tag(s, lhs)) ? lhs : 0;
+            break;
+        case TOK_BANG:
+            type = lhs && sema_is_scalar(sema_tag(s, lhs)) ? sema_basic_type(s, TYPE_INT) : 0;
+            break;
+        case TOK_SIZEOF:
+            type = lhs && ast_type_size(ast, lhs) != 0 ? sema_basic_type(s, TYPE_UNSIGNED_LONG) : 0;
+            break;
+        case TOK_TILDE:
+            type = sema_integer(s, lhs, lhs);
+            break;
+        default:
+            type = sema_arithmetic(s, lhs, lhs);
+            break;
+        }
+        if(lhs && !type && e->op != TOK_STAR) sema_report_operands(s, e->loc, (TokenTag)e->op);
+        break;
+    case EXPRESSION_POSTFIX:
+        lhs = sema_expression(s, e->a);
+        sema_expect_lvalue(s, e->a, e->loc);
+        type = lhs && sema_is_scalar(sema_tag(s, lhs)) ? lhs : 0;
+        if(lhs && !type) sema_report_operands(s, e->loc, (TokenTag)e->op);
+        break;
+    case EXPRESSION_BINARY:
+        lhs = sema_expression(s, e->a);
+        rhs = sema_expression(s, e->b);
+        type = sema_binary(s, (TokenTag)e->op, e->a, lhs, e->b, rhs);
+        if(lhs && rhs && !type) {
+            if(e->op == TOK_OPEN_BRACKET && !sema_pointee(s, lhs) && !sema_pointee(s, rhs)) {
+                diag_report(s->diag, e->loc, "Subscripted value is not a pointer");
+            } else {
+                sema_report_operands(s, e->loc, (TokenTag)e->op);
+            }
+        }
+        break;
+    case EXPRESSION_ASSIGN:
+        type = sema_expression(s, e->a);
+        rhs = sema_expression(s, e->b);
+        sema_expect_lvalue(s, e->a, e->loc);
+        if(e->op == TOK_ASSIGN) {
+            if(!sema_assignable(s, type, rhs, e->b)) diag_report(s->diag, e->loc, "Incompatible types in assignment");
+        } else if(type && rhs && !sema_binary(s, sema_compound_operator((TokenTag)e->op), e->a, type, e->b, rhs)) {
+            sema_report_operands(s, e->loc, (TokenTag)e->op);
+        }
+        break;
+    case EXPRESSION_CONDITIONAL:
+        sema_condition(s, e->a);
+        lhs = sema_expression(s, e->b);
+        rhs = sema_expression(s, e->c);
+        if(lhs == 0 || rhs == 0) {
+            type = lhs ? lhs : rhs;
+        } else if((type = sema_arithmetic(s, lhs, rhs)) != 0 || ast_same_type(ast, lhs, rhs)) {
+            if(!type) type = lhs;
+        } else if(sema_pointee(s, lhs) && (sema_is_null_pointer(s, e->c) || (sema_pointee(s, rhs) && sema_pointers_agree(s, lhs, rhs)))) {
+            /*a void pointer arm makes the result one*/
+            type = sema_pointee(s, rhs) && sema_tag(s, sema_pointee(s, rhs)) == TYPE_VOID ? rhs : lhs;
+        } else if(sema_pointee(s, rhs) && sema_is_null_pointer(s, e->b)) {
+            type = rhs;
+        } else {
+            diag_report(s->diag, e->loc, "Type mismatch in conditional expression");
+        }
+        break;
+    case EXPRESSION_CALL:
+        lhs = sema_expression(s, e->a);
+        for(i = 0; i < e->c; ++i) (void)sema_expression(s, ast->lists.items[e->b + i]);
+        type = sema_call(s, e, lhs);
+        break;
+    case EXPRESSION_MEMBER:
+        /*struct types are not parsed yet*/
+        (void)sema_expression(s, e->a);
+        break;
+    case EXPRESSION_CAST:
+        lhs = sema_expression(s, e->a);
+        type = e->b;
+        if(!sema_castable(s, type, lhs)) diag_report(s->diag, e->loc, "Invalid cast");
+        break;
+    case EXPRESSION_SIZEOF_TYPE:
+        type = sema_basic_type(s, TYPE_UNSIGNED_LONG);
+        break;
+    }
+    ast->expression_types.items[index] = type;
+    return type;
+}
+
+void sema_statement(Sema * s, AstIndex index);
+
+/*Checks an expression that is tested for being nonzero*/
+void sema_condition(Sema * s, AstIndex index) {
+    const AstIndex type = sema_expression(s, index);
+    if(type != 0 && !sema_is_scalar(sema_tag(s, type))) {
+        diag_report(s->diag, s->ast->expressions.items[index].loc, "Condition is not a scalar value");
+    }
+}
+
+/*Checks the initializer of a declaration of `name` with `type`, if it has one*/
+void sema_initializer(Sema * s, AstIndex type, AstIndex name, AstIndex init) {
+    const AstIndex init_type = sema_expression(s, init);
+    if(init != 0 && !sema_assignable(s, type, init_type, init)) {
+        diag_report_str(s->diag, s->ast->expressions.items[init].loc, "Incompatible initializer for", ast_name(s->ast, name));
+    }
+}
+
+/*A case label must be an integer constant expression, folded into a
+  literal afterwards by ast_fold_constants*/
+void sema_case_label(Sema * s, AstIndex index) {
+    const SrcLoc loc = s->ast->expressions.items[index].loc;
+    ConstValue v;
+    switch(ast_eval_constant(s->ast, index, &v)) {
+    case CONST_OK:
+        break;
+    case CONST_DIVISION_BY_ZERO:
+        diag_report(s->diag, loc, "Division by zero in constant expression");
+        break;
+    case CONST_NOT_CONSTANT:
+        diag_report(s->diag, loc, "Case label is not an integer constant expression");
+        break;
+    }
+}
+
+/*The statements of a compound statement, in the current scope*/
+void sema_statements(Sema * s, AstIndex index) {
+    const AstStatement * st = &s->ast->statements.items[index];
+    unsigned int i;
+    for(i = 0; i < st->b; ++i) sema_statement(s, s->ast->lists.items[st->a + i]);
+}
+
+void sema_statement(Sema * s, AstIndex index) {
+    AstStatement * st = &s->ast->statements.items[index];
+    const unsigned int mark = s->log.len;
+    const AstIndex scope_first = s->scope_first;
+    AstIndex type;
+    if(index == 0) return;
+    switch((StatementTag)s->ast->statement_tags.items[index]) {
+    case STATEMENT_RETURN:
+        type = sema_expression(s, st->a);
+        if(st->a != 0 && sema_tag(s, s->return_type) == TYPE_VOID) {
+            diag_report(s->diag, st->loc, "Return with a value in a function returning void");
+        } else if(!sema_assignable(s, s->return_type, type, st->a)) {
+            diag_report(s->diag, st->loc, "Incompatible return value");
+        }
+        break;
+    case STATEMENT_EXPRESSION:
+        (void)sema_expression(s, st->a);
+        break;
+    case STATEMENT_DECLARATION:
+        /*in scope from its declarator on, its initializer included*/
+        st->d = sema_declare(s, SYMBOL_LOCAL, st->b, st->a, index, st->loc);
+        sema_initializer(s, st->a, st->b, st->c);
+        break;
+    case STATEMENT_STATIC:
+    case STATEMENT_EXTERN:
+        st->d = sema_declare(s, SYMBOL_STATIC, st->b, st->a, index, st->loc);
+        if(st->c != 0 && s->ast->statement_tags.items[index] == STATEMENT_EXTERN) {
+            diag_report_str(s->diag, st->loc, "Initialized extern declaration", ast_name(s->ast, st->b));
+        }
+        sema_initializer(s, st->a, st->b, st->c);
+        break;
+    case STATEMENT_TYPEDEF:
+        (void)sema_declare(s, SYMBOL_TYPEDEF, st->b, st->a, index, st->loc);
+        break;
+    case STATEMENT_COMPOUND:
+        s->scope_first = s->ast->symbols.len;
+        sema_statements(s, index);
+        sema_leave_scope(s, mark, scope_first);
+        break;
+    case STATEMENT_IF:
+        sema_condition(s, st->a);
+        sema_statement(s, st->b);
+        sema_statement(s, st->c);
+        break;
+    case STATEMENT_CASE:
+        (void)sema_expression(s, st->a);
+        sema_case_label(s, st->a);
+        sema_statement(s, st->b);
+        break;
+    case STATEMENT_WHILE:
+    case STATEMENT_DO:
+        sema_condition(s, st->a);
+        sema_statement(s, st->b);
+        break;
+    case STATEMENT_SWITCH:
+        type = sema_expression(s, st->a);
+        if(type != 0 && !sema_is_integer(sema_tag(s, type))) {
+            diag_report(s->diag, s->ast->expressions.items[st->a].loc, "Switch condition is not an integer");
+        }
+        sema_statement(s, st->b);
+        break;
+    case STATEMENT_DEFAULT:
+    case STATEMENT_LABEL:
+        sema_statement(s, st->b);
+        break;
+    case STATEMENT_FOR:
+        (void)sema_expression(s, st->a);
+        if(st->b) sema_condition(s, st->b);
+        (void)sema_expression(s, st->c);
+        sema_statement(s, st->d);
+        break;
+    default:
+        break;
+    }
+}
+
+/*The body shares its scope with the parameters, so a local cannot
+  redeclare one*/
+void sema_function(Sema * s, AstIndex toplevel) {
+    Ast * ast = s->ast;
+    const Toplevel * t = &s->toplevels->items[toplevel];
+    FunctionDefinition * def = &s->toplevels->items[toplevel].as.function_definition;
+    const AstIndex type = ast_type(ast, s->arena, TYPE_FUNCTION, 0, def->prototype.return_type);
+    unsigned int mark;
+    unsigned int i;
+    (void)sema_declare(s, SYMBOL_FUNCTION, def->prototype.name, type, toplevel, t->loc);
+    if(def->body == 0) return;
+    mark = s->log.len;
+    s->scope_first = ast->symbols.len;
+    s->in_function = CORE_TRUE;
+    s->return_type = def->prototype.return_type;
+    s->frame_size = 0;
+    for(i = 0; i < def->prototype.parameter_count; ++i) {
+        const AstIndex param = def->prototype.first_parameter + i;
+        (void)sema_declare(s, SYMBOL_PARAMETER, ast->parameters.items[param].name, ast->parameters.items[param].type, param, t->loc);
+    }
+    sema_statements(s, def->body);
+    def->frame_size = s->frame_size;
+    s->in_function = CORE_FALSE;
+    sema_leave_scope(s, mark, 1);
+}
+
+/*Resolves and types the whole tree. Bodies must have been parsed, a
+  skipped one is checked as a prototype. Errors are reported and the
+  walk goes on, so one run finds all of them*/
+void sema_translation_unit(Ast * ast, core_Arena * a, Diagnostics * diag, Toplevels * toplevels) {
+    Sema s;
+    unsigned int i;
+    memset(&s, 0, sizeof(s));
+    s.ast = ast;
+    s.arena = a;
+    s.diag = diag;
+    s.toplevels = toplevels;
+    s.scope_first = 1;
+    while(s.bindings.len < ast->names.len) core_vec_append(&s.bindings, a, 0);
+    while(ast->expression_types.len < ast->expressions.len) core_vec_append(&ast->expression_types, a, 0);
+
+    for(i = 0; i < toplevels->len; ++i) {
+        Toplevel * t = &toplevels->items[i];
+        switch(t->tag) {
+        case TOPLEVEL_FUNCTION_DEFINITION:
+            sema_function(&s, i);
+            break;
+        case TOPLEVEL_DECLARATION:
+            (void)sema_declare(&s, SYMBOL_GLOBAL, t->as.declaration.name, t->as.declaration.type, i, t->loc);
+            sema_initializer(&s, t->as.declaration.type, t->as.declaration.name, t->as.declaration.init);
+            break;
+        case TOPLEVEL_TYPEDEF:
+            (void)sema_declare(&s, SYMBOL_TYPEDEF, t->as.declaration.name, t->as.declaration.type, i, t->loc);
+            break;
+        }
+    }
+    core_arena_reclaim_memory(a, s.bindings.items);
+    if(s.log.items) core_arena_reclaim_memory(a, s.log.items);
+}
+
+/**** AST FILES ****/
+
+/*A parsed translation unit written out as the arrays it is made of, so
+  it can be mapped back and used in place. The header gives each array's
+  offset from the start of the file, so the file can be mapped anywhere,
+  and the names are the interned table of the tree. Nothing is converted
+  on the way in or out: a file is only read by a build with the same
+  byte order and the same layout, which the header records*/
+#define AST_FILE_VERSION 7
+#define AST_FILE_ALIGN 16
+#define AST_FILE_BYTE_ORDER 0x01020304u
+
+#define DO_AST_SECTIONS(x)                                                    \
+    x(expression_tags) x(expressions) x(statement_tags) x(statements)        \
+    x(lists) x(values) x(types) x(parameters) x(names) x(strings)            \
+    x(expression_types) x(symbols)
+
+#define AST_SECTION_ENUM(field) AST_SECTION_##field,
+
+enum {
+    DO_AST_SECTIONS(AST_SECTION_ENUM)
+    AST_SECTION_TOPLEVELS,
+    AST_SECTION_COUNT
+};
+
+typedef struct {
+    unsigned int offset; /*from the start of the file, a multiple of AST_FILE_ALIGN*/
+    unsigned int count;
+    unsigned int size; /*of one element*/
+} AstFileSection;
+
+typedef struct {
+    char magic[4]; /*"FCAS"*/
+    unsigned int version;
+    unsigned int byte_order; /*AST_FILE_BYTE_ORDER as the writer stored it*/
+    unsigned int size; /*of the whole file*/
+    AstFileSection sections[AST_SECTION_COUNT];
+} AstFileHeader;
+
+typedef struct {
+    void * map;
+    size_t size;
+    Ast ast; /*arrays point into the mapping and are read only*/
+    Toplevels toplevels;
+} AstFile;
+
+#define ast_file_align(n) (((n) + AST_FILE_ALIGN - 1) & ~(unsigned long)(AST_FILE_ALIGN - 1))
+
+void ast_file_section(AstFileHeader * h, unsigned int section, unsigned long * offset, unsigned int count, unsigned int size) {
+    h->sections[section].offset = (unsigned int)*offset;
+    h->sections[section].count = count;
+    h->sections[section].size = size;
+    *offset = ast_file_align(*offset + (unsigned long)count * size);
+}
+
+/*Writes zeros from `*at` up to `to`, the next section or the end of the file*/
+core_Bool ast_file_pad(FILE * fp, unsigned long * at, unsigned long to) {
+    static const char zeros[AST_FILE_ALIGN];
+    const size_t n = (size_t)(to - *at);
+    *at = to;
+    return fwrite(zeros, 1, n, fp) == n;
+}
+
+core_Bool ast_file_put(FILE * fp, unsigned long * at, const AstFileSection * section, const void * items) {
+    const size_t bytes = (size_t)section->count * section->size;
+    if(!ast_file_pad(fp, at, section->offset)) return CORE_FALSE;
+    *at += bytes;
+    return bytes == 0 || fwrite(items, 1, bytes, fp) == bytes;
+}
+
+#define AST_SECTION_LAYOUT(field) \
+    ast_file_section(&h, AST_SECTION_##field, &offset, ast->field.len, sizeof(ast->field.items[0]));
+#define AST_SECTION_PUT(field) \
+    ok = ok && ast_file_put(fp, &at, &h.sections[AST_SECTION_##field], ast->field.items);
+
+/*Opens a new file next to path, to be renamed over it once written. The
+  name holds the process id and the file is created exclusively, so
+  writers running at the same time never share one. tmp must have room
+  for PP_MAX_PATH + 32 chars*/
+FILE * temp_file_open(const char * path, char * tmp) {
+    unsigned int i;
+    if(strlen(path) >= PP_MAX_PATH) return NULL;
+    for(i = 0; i < 100; ++i) {
+        int fd;
+        sprintf(tmp, "%s.%ld.%u.tmp", path, (long)getpid(), i);
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if(fd >= 0) {
+            FILE * fp;
+            close(fd);
+            fp = fopen(tmp, "wb");
+            if(!fp) remove(tmp);
+            return fp;
+        }
+        if(errno != EEXIST) return NULL;
+    }
+    return NULL;
+}
+
+/*Writes the tree and its toplevels to `path`, through a temporary file
+  renamed into place so a reader never sees half of it. Bodies must have
+  been parsed, skipped ones are written as prototypes*/
+core_Bool ast_file_write(const char * path, const Ast * ast, const Toplevels * toplevels) {
+    AstFileHeader h;
+    unsigned long offset = ast_file_align(sizeof(h));
+    unsigned long at = sizeof(h);
+    char tmp[PP_MAX_PATH + 32];
+    FILE * fp;
+    unsigned int i;
+    core_Bool ok = CORE_TRUE;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "FCAS", 4);
+    h.version = AST_FILE_VERSION;
+    h.byte_order = AST_FILE_BYTE_ORDER;
+    DO_AST_SECTIONS(AST_SECTION_LAYOUT)
+    ast_file_section(&h, AST_SECTION_TOPLEVELS, &offset, toplevels->len, sizeof(Toplevel));
+    if(offset > UINT_MAX || strlen(path) >= PP_MAX_PATH) return CORE_FALSE;
+    h.size = (unsigned int)offset;
+
+    fp = temp_file_open(path, tmp);
+    if(!fp) return CORE_FALSE;
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    DO_AST_SECTIONS(AST_SECTION_PUT)
+    ok = ok && ast_file_pad(fp, &at, h.sections[AST_SECTION_TOPLEVELS].offset);
+    for(i = 0; ok && i < toplevels->len; ++i) {
+        Toplevel t = toplevels->items[i];
+        if(t.tag == TOPLEVEL_FUNCTION_DEFINITION) {
+            t.as.function_definition.skipped_first = 0;
+            t.as.function_definition.skipped_count = 0;
+            t.as.function_definition.typedef_mark = 0;
+        }
+        ok = fwrite(&t, sizeof(t), 1, fp) == 1;
+        at += sizeof(t);
+    }
+    ok = ok && ast_file_pad(fp, &at, h.size);
+    ok = fclose(fp) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if(!ok) remove(tmp);
+    return ok;
+}
+
+#define AST_SECTION_CHECK(field) \
+    ok = ok && ast_file_check(h, AST_SECTION_##field, sizeof(out->ast.field.items[0]));
+#define AST_SECTION_MAP(field)                                                          \
+    out->ast.field.items = (void *)(base + h->sections[AST_SECTION_##field].offset);    \
+    out->ast.field.len = out->ast.field.cap = h->sections[AST_SECTION_##field].count;
+
+/*Whether a section lies inside the file and holds what this build expects*/
+core_Bool ast_file_check(const AstFileHeader * h, unsigned int section, size_t size) {
+    const AstFileSection * s = &h->sections[section];
+    return s->size == size && s->offset % AST_FILE_ALIGN == 0 && s->offset <= h->size
+        && s->count <= (h->size - s->offset) / size;
+}
+
+void ast_file_unmap(AstFile * f) {
+    if(f->map) munmap(f->map, f->size);
+    memset(f, 0, sizeof(*f));
+}
+
+#define AST_FILE_MAX_DEPTH (2 * PARSE_MAX_DEPTH) /*deeper than any parse makes*/
+
+/*Whether x indexes an array of len, keeping the deepest nesting seen*/
+#define AST_FILE_INDEX(x, len, depths) \
+    ((x) < (len) && ((deepest = CORE_MAX(deepest, (depths)[x])), CORE_TRUE))
+#define ast_file_spelled(op) ((op) < CORE_ARRAY_LEN(dfa_spelling) && dfa_spelling[op] != NULL)
+
+/*Whether every index in a mapped tree is inside the array it indexes and
+  every child comes before its parent, so walking the tree can not read
+  outside the mapping or loop. The nesting is bounded too, so the
+  recursive walks can not run out of stack. One pass over each array*/
+core_Bool ast_file_valid(const Ast * ast, const Toplevels * toplevels) {
+    const unsigned long names = ast->names.len;
+    const unsigned long types = ast->types.len;
+    const unsigned long expressions = ast->expressions.len;
+    const unsigned long statements = ast->statements.len;
+    const unsigned long lists = ast->lists.len;
+    unsigned int * type_depth;
+    unsigned int * expression_depth;
+    unsigned int * statement_depth;
+    core_Arena a;
+    core_Bool ok;
+    unsigned long i, j;
+
+    /*index 0, the missing node, is in every array*/
+    if(names == 0 || types == 0 || expressions == 0 || statements == 0 || ast->symbols.len == 0
+       || ast->expression_tags.len != expressions || ast->statement_tags.len != statements) {
+        return CORE_FALSE;
+    }
+    memset(&a, 0, sizeof(a));
+    type_depth = core_arena_alloc(&a, sizeof(unsigned int) * (types + expressions + statements));
+    expression_depth = type_depth + types;
+    statement_depth = expression_depth + expressions;
+    type_depth[0] = expression_depth[0] = statement_depth[0] = 0;
+    ok = CORE_TRUE;
+
+    for(i = 0; ok && i < names; ++i) {
+        const AstString * n = &ast->names.items[i];
+        ok = n->offset < ast->strings.len && n->len < ast->strings.len - n->offset;
+    }
+    /*only pointer and function types nest when a type is walked, a
+      typedef name is a leaf*/
+    for(i = 0; ok && i < types; ++i) {
+        const TypeSpecifier * t = &ast->types.items[i];
+        ok = t->tag <= TYPE_NAME && t->name < names && t->canonical <= i
+            && (t->base < i || (t->base == 0 && t->tag != TYPE_POINTER && t->tag != TYPE_FUNCTION));
+        type_depth[i] = ok && (t->tag == TYPE_POINTER || t->tag == TYPE_FUNCTION) ? type_depth[t->base] + 1 : 1;
+        ok = ok && type_depth[i] <= AST_FILE_MAX_DEPTH;
+    }
+    for(i = 0; ok && i < ast->parameters.len; ++i) {
+        ok = ast->parameters.items[i].type < types && ast->parameters.items[i].name < names;
+    }
+    for(i = 0; ok && i < ast->expression_types.len; ++i) ok = ast->expression_types.items[i] < types;
+    for(i = 1; ok && i < ast->symbols.len; ++i) {
+        const AstSymbol * sym = &ast->symbols.items[i];
+        ok = sym->name < names && sym->type < types;
+        switch(sym->kind) {
+        case SYMBOL_GLOBAL: case SYMBOL_FUNCTION: ok = ok && sym->declaration < toplevels->len; break;
+        case SYMBOL_PARAMETER: ok = ok && sym->declaration < ast->parameters.len; break;
+        case SYMBOL_LOCAL: case SYMBOL_STATIC: ok = ok && sym->declaration < statements; break;
+        case SYMBOL_TYPEDEF: ok = ok && sym->declaration < CORE_MAX(toplevels->len, statements); break;
+        default: ok = CORE_FALSE; break;
+        }
+    }
+
+    for(i = 1; ok && i < expressions; ++i) {
+        const AstExpression * e = &ast->expressions.items[i];
+        unsigned int deepest = 0;
+        ok = e->op < TOK_COUNT;
+        switch((ExpressionTag)ast->expression_tags.items[i]) {
+        case EXPRESSION_IDENTIFIER:
+            ok = ok && e->a < names && e->b < ast->symbols.len;
+            break;
+        case EXPRESSION_INT_LITERAL:
+            ok = ok && e->a < ast->values.len && e->b <= INT_LITERAL_UNSIGNED_LONG && e->c < names;
+            break;
+        case EXPRESSION_FLOAT_LITERAL:
+        case EXPRESSION_CHAR_LITERAL:
+        case EXPRESSION_STRING_LITERAL:
+            ok = ok && e->c < names;
+            break;
+        case EXPRESSION_UNARY:
+        case EXPRESSION_POSTFIX:
+            ok = ok && ast_file_spelled(e->op) && AST_FILE_INDEX(e->a, i, expression_depth);
+            break;
+        case EXPRESSION_BINARY:
+        case EXPRESSION_ASSIGN:
+            ok = ok && (e->op == TOK_OPEN_BRACKET || ast_file_spelled(e->op))
+                && AST_FILE_INDEX(e->a, i, expression_depth) && AST_FILE_INDEX(e->b, i, expression_depth);
+            break;
+        case EXPRESSION_CONDITIONAL:
+            ok = ok && AST_FILE_INDEX(e->a, i, expression_depth) && AST_FILE_INDEX(e->b, i, expression_depth)
+                && AST_FILE_INDEX(e->c, i, expression_depth);
+            break;
+        case EXPRESSION_CALL:
+            ok = ok && AST_FILE_INDEX(e->a, i, expression_depth) && e->b <= lists && e->c <= lists - e->b;
+            for(j = 0; ok && j < e->c; ++j) ok = AST_FILE_INDEX(ast->lists.items[e->b + j], i, expression_depth);
+            break;
+        case EXPRESSION_MEMBER:
+            ok = ok && ast_file_spelled(e->op) && AST_FILE_INDEX(e->a, i, expression_depth) && e->b < names;
+            break;
+        case EXPRESSION_CAST:
+            ok = ok && AST_FILE_INDEX(e->a, i, expression_depth) && AST_FILE_INDEX(e->b, types, type_depth);
+            break;
+        case EXPRESSION_SIZEOF_TYPE:
+            ok = ok && AST_FILE_INDEX(e->b, types, type_depth);
+            break;
+        default:
+            ok = CORE_FALSE;
+            break;
+        }
+        expression_depth[i] = deepest + 1;
+        ok = ok && expression_depth[i] <= AST_FILE_MAX_DEPTH;
+    }
+
+    /*statement 0 is printed for a missing branch, so it is checked too,
+      and can have no statements in it*/
+    for(i = 0; ok && i < statements; ++i) {
+        const AstStatement * st = &ast->statements.items[i];
+        const unsigned long before = i;
+        unsigned int deepest = 0;
+        switch((StatementTag)ast->statement_tags.items[i]) {
+        case STATEMENT_RETURN:
+        case STATEMENT_EXPRESSION:
+            ok = AST_FILE_INDEX(st->a, expressions, expression_depth);
+            break;
+        case STATEMENT_DECLARATION:
+        case STATEMENT_STATIC:
+        case STATEMENT_EXTERN:
+            ok = AST_FILE_INDEX(st->a, types, type_depth) && st->b < names
+                && AST_FILE_INDEX(st->c, expressions, expression_depth) && st->d < ast->symbols.len;
+            break;
+        case STATEMENT_TYPEDEF:
+            ok = AST_FILE_INDEX(st->a, types, type_depth) && st->b < names;
+            break;
+        case STATEMENT_COMPOUND:
+            ok = st->a <= lists && st->b <= lists - st->a;
+            for(j = 0; ok && j < st->b; ++j) ok = AST_FILE_INDEX(ast->lists.items[st->a + j], before, statement_depth);
+            break;
+        case STATEMENT_IF:
+            ok = AST_FILE_INDEX(st->a, expressions, expression_depth) && AST_FILE_INDEX(st->b, before, statement_depth)
+                && AST_FILE_INDEX(st->c, before, statement_depth);
+            break;
+        case STATEMENT_WHILE:
+        case STATEMENT_DO:
+        case STATEMENT_SWITCH:
+        case STATEMENT_CASE:
+            ok = AST_FILE_INDEX(st->a, expressions, expression_depth) && AST_FILE_INDEX(st->b, before, statement_depth);
+            break;
+        case STATEMENT_FOR:
+            ok = AST_FILE_INDEX(st->a, expressions, expression_depth) && AST_FILE_INDEX(st->b, expressions, expression_depth)
+                && AST_FILE_INDEX(st->c, expressions, expression_depth) && AST_FILE_INDEX(st->d, before, statement_depth);
+            break;
+        case STATEMENT_DEFAULT:
+            ok = AST_FILE_INDEX(st->b, before, statement_depth);
+            break;
+        case STATEMENT_LABEL:
+            ok = st->a < names && AST_FILE_INDEX(st->b, before, statement_depth);
+            break;
+        case STATEMENT_GOTO:
+            ok = st->a < names;
+            break;
+        case STATEMENT_BREAK:
+        case STATEMENT_CONTINUE:
+        case STATEMENT_EMPTY:
+            break;
+        default:
+            ok = CORE_FALSE;
+            break;
+        }
+        statement_depth[i] = deepest + 1;
+        ok = ok && statement_depth[i] <= AST_FILE_MAX_DEPTH;
+    }
+
+    for(i = 0; ok && i < toplevels->len; ++i) {
+        const Toplevel * t = &toplevels->items[i];
+        const FunctionDefinition * def = &t->as.function_definition;
+        ok = t->storage <= STORAGE_EXTERN;
+        switch(t->tag) {
+        case TOPLEVEL_FUNCTION_DEFINITION:
+            ok = ok && def->prototype.name < names && def->prototype.return_type < types
+                && def->prototype.first_parameter <= ast->parameters.len
+                && def->prototype.parameter_count <= ast->parameters.len - def->prototype.first_parameter
+                && def->skipped_count == 0
+                && (def->body == 0 || (def->body < statements && ast->statement_tags.items[def->body] == STATEMENT_COMPOUND));
+            break;
+        case TOPLEVEL_DECLARATION:
+        case TOPLEVEL_TYPEDEF:
+            ok = ok && t->as.declaration.type < types && t->as.declaration.name < names && t->as.declaration.init < expressions;
+            break;
+        default:
+            ok = CORE_FALSE;
+            break;
+        }
+    }
+    core_arena_free(&a);
+    return ok;
+}
+
+/*Maps a file written by ast_file_write. The layout is checked, then every
+  index inside the arrays, so a damaged file is rejected rather than read*/
+core_Bool ast_file_map(AstFile * out, const char * path) {
+    const AstFileHeader * h;
+    const char * base;
+    struct stat st;
+    core_Bool ok;
+    const int fd = open(path, O_RDONLY);
+    memset(out, 0, sizeof(*out));
+    if(fd < 0) return CORE_FALSE;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AstFileHeader)) {
+        close(fd);
+        return CORE_FALSE;
+    }
+    out->size = (size_t)st.st_size;
+    out->map = mmap(NULL, out->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(out->map == MAP_FAILED) {
+        out->map = NULL;
+        return CORE_FALSE;
+    }
+
+    base = out->map;
+    h = out->map;
+    ok = memcmp(h->magic, "FCAS", 4) == 0 && h->version == AST_FILE_VERSION
+        && h->byte_order == AST_FILE_BYTE_ORDER && h->size == out->size;
+    DO_AST_SECTIONS(AST_SECTION_CHECK)
+    ok = ok && ast_file_check(h, AST_SECTION_TOPLEVELS, sizeof(Toplevel));
+    ok = ok && h->sections[AST_SECTION_strings].count > 0 && base[h->sections[AST_SECTION_strings].offset + h->sections[AST_SECTION_strings].count - 1] == 0;
+    if(!ok) {
+        munmap(out->map, out->size);
+        memset(out, 0, sizeof(*out));
+        return CORE_FALSE;
+    }
+    DO_AST_SECTIONS(AST_SECTION_MAP)
+    out->toplevels.items = (void *)(base + h->sections[AST_SECTION_TOPLEVELS].offset);
+    out->toplevels.len = out->toplevels.cap = h->sections[AST_SECTION_TOPLEVELS].count;
+    if(!ast_file_valid(&out->ast, &out->toplevels)) {
+        ast_file_unmap(out);
+        return CORE_FALSE;
+    }
+    return CORE_TRUE;
+}
+
+/**** LIBRARY ****/
+
+/*A context holds everything a compile needs, so any number of them can
+  be used at once, from different threads too. Options are kept from one
+  compile to the next while the memory of the last compile is freed at
+  the start of the next one*/
+typedef enum {
+    FORTHCC_OK,
+    FORTHCC_ERRORS, /*compiled, but there were diagnostics*/
+    FORTHCC_ABORTED /*an error stopped the compile*/
+} ForthccStatus;
+
+typedef struct {
+    /*options, the strings must outlive the context*/
+    core_Vec(const char *) include_dirs;
+    core_Vec(const char *) defines; /*NAME or NAME=VALUE*/
+    unsigned int threads;
+    core_Bool parse; /*print the tree instead of the tokens, bodies included*/
+    core_Bool skim; /*print the tree, bodies skipped unless parse is set too*/
+    core_Bool check; /*with parse, resolve names, check types and fold constants, see SEMANTIC ANALYSIS*/
+    const char * ast_out; /*with parse or skim, the tree is also written here, see AST FILES*/
+    core_Bool read_ast; /*the input is a file written with ast_out, printed without lexing or parsing*/
+    FILE * echo; /*diagnostics are printed here as they are reported, when set*/
+    core_Arena options_arena;
+
+    /*the last compile, valid until the next one or forthcc_free*/
+    core_Arena arena;
+    SourceManager sm;
+    Diagnostics diag;
+    jmp_buf bail;
+} ForthccContext;
+
+static pthread_once_t scan_kernel_once = PTHREAD_ONCE_INIT;
+
+/*core_scan_fns picks the kernel on its first call without a lock*/
+static void scan_kernel_init(void) {
+    (void)core_scan_fns();
+}
+
+void forthcc_init(ForthccContext * ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->threads = 1;
+    pthread_once(&scan_kernel_once, scan_kernel_init);
+}
+
+void forthcc_free(ForthccContext * ctx) {
+    core_arena_free(&ctx->arena);
+    core_arena_free(&ctx->options_arena);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void forthcc_add_include_dir(ForthccContext * ctx, const char * dir) {
+    core_vec_append(&ctx->include_dirs, &ctx->options_arena, dir);
+}
+
+void forthcc_define(ForthccContext * ctx, const char * definition) {
+    core_vec_append(&ctx->defines, &ctx->options_arena, definition);
+}
+
+void forthcc_run(ForthccContext * ctx, const char * input, FILE * output) {
+    core_Arena * a = &ctx->arena;
+    Preprocessor pp;
+    Lexer l;
+    TokenStream s;
+    Tokens tokens = {0};
+    unsigned int i;
+
+    if(ctx->read_ast) {
+        AstFile file;
+        if(!ast_file_map(&file, input)) {
+            Str name;
+            name.ptr = input;
+            name.len = strlen(input);
+            diag_report_str(&ctx->diag, SRCLOC_NONE, "Not a readable AST file", name);
+            diag_bail(&ctx->diag);
+        }
+        for(i = 0; i < file.toplevels.len; ++i) toplevel_fprint(output, &file.ast, &file.toplevels.items[i]);
+        ast_file_unmap(&file);
+        return;
+    }
+
+    pp_init(&pp, &ctx->sm, a);
+    for(i = 0; i < ctx->include_dirs.len; ++i) pp_add_include_dir(&pp, ctx->include_dirs.items[i]);
+    for(i = 0; i < ctx->defines.len; ++i) pp_define_string(&pp, ctx->defines.items[i]);
+
+    if(streql(input, "-")) {
+        lexer_init_stream(&l, &ctx->sm, a, 0, "<stdin>");
+        pp_push_lexer(&pp, &l);
+    } else if(ctx->threads > 1) {
+        const unsigned int loaded = ctx->sm.files.len;
+        tokens = tokenize_file_parallel(a, &ctx->sm, input, ctx->threads);
+        if(ctx->sm.files.len == loaded) diag_bail(&ctx->diag);
+        pp_push_tokens(&pp, &tokens);
+    } else {
+        if(!lexer_open(&ctx->sm, &l, input)) diag_bail(&ctx->diag);
+        pp_push_lexer(&pp, &l);
+    }
+    ts_init_pp(&s, &pp);
+    /*skim only reads declarations, with parse the bodies are parsed
+      afterwards. With more than one thread they are skimmed and parsed
+      on that many threads*/
+    if(ctx->parse || ctx->skim) {
+        Parser p;
+        Ast ast;
+        Toplevels toplevels;
+        ast_init(&ast, a);
+        parser_init(&p, &s, a, &ast, &ctx->diag);
+        p.skip_bodies = ctx->skim || ctx->threads > 1;
+        toplevels = parse_translation_unit(&p);
+        if(ctx->parse && ctx->threads > 1) parse_bodies_parallel(&p, &toplevels, ctx->threads);
+        for(i = 0; ctx->parse && ctx->check && i < toplevels.len; ++i) {
+            Toplevel * t = &toplevels.items[i];
+            if(t->tag == TOPLEVEL_FUNCTION_DEFINITION) (void)parse_function_body(&p, &t->as.function_definition);
+        }
+        if(ctx->parse && ctx->check) {
+            sema_translation_unit(&ast, a, &ctx->diag, &toplevels);
+            ast_fold_constants(&ast, a);
+        }
+        for(i = 0; i < toplevels.len; ++i) {
+            Toplevel * t = &toplevels.items[i];
+            if(ctx->parse && t->tag == TOPLEVEL_FUNCTION_DEFINITION) (void)parse_function_body(&p, &t->as.function_definition);
+            toplevel_fprint(output, &ast, t);
+        }
+        if(ctx->ast_out && !ast_file_write(ctx->ast_out, &ast, &toplevels)) {
+            diag_report(&ctx->diag, SRCLOC_NONE, "Failed to write the AST file");
+        }
+    }
+    while(ts_tag(&s) != TOK_EOF) {
+        token_fprint(output, *ts_advance(&s));
+        fprintf(output, "\n");
+    }
+}
+
+/*Compiles `input`, a path or "-" for stdin, writing the tokens or the
+  tree to `output`. The diagnostics stay in ctx->diag until the next compile*/
+ForthccStatus forthcc_compile(ForthccContext * ctx, const char * input, FILE * output) {
+    core_arena_free(&ctx->arena);
+    srcmgr_init(&ctx->sm, &ctx->arena, &ctx->diag);
+    diag_init(&ctx->diag, &ctx->sm, &ctx->arena, ctx->echo);
+    ctx->diag.bail = &ctx->bail;
+    if(setjmp(ctx->bail) != 0) {
+        ctx->diag.bail = NULL;
+        return FORTHCC_ABORTED;
+    }
+    forthcc_run(ctx, input, output);
+    ctx->diag.bail = NULL;
+    return ctx->diag.items.len > 0 ? FORTHCC_ERRORS : FORTHCC_OK;
+}
+
+int main(int argc, char ** argv) {
+    ForthccContext ctx;
+    const char * path = "test-cases/001.c";
+    int status;
+    int i;
+
+    forthcc_init(&ctx);
+    ctx.echo = stderr;
+    for(i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "-j", 2) == 0) ctx.threads = (unsigned int)atoi(argv[i] + 2);
+        else if(strncmp(argv[i], "-I", 2) == 0) forthcc_add_include_dir(&ctx, argv[i] + 2);
+        else if(strncmp(argv[i], "-D", 2) == 0) forthcc_define(&ctx, argv[i] + 2);
+        else if(streql(argv[i], "--parse")) ctx.parse = CORE_TRUE;
+        else if(streql(argv[i], "--skim")) ctx.skim = CORE_TRUE;
+        else if(streql(argv[i], "--check")) ctx.check = CORE_TRUE;
+        else if(strncmp(argv[i], "--ast-out=", 10) == 0) ctx.ast_out = argv[i] + 10;
+        else if(streql(argv[i], "--read-ast")) ctx.read_ast = CORE_TRUE;
+        else path = argv[i];
+    }
+
+    status = forthcc_compile(&ctx, path, stdout) != FORTHCC_OK;
+    forthcc_free(&ctx);
+    return status;
 }
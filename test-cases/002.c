@@ -0,0 +1,26 @@
+/* Hide-sets: the example of C89 3.8.3.5, a name is not expanded again
+   inside its own expansion, and self-reference through other macros
+   stops at the first repeat */
+#define x 3
+#define f(a) f(x * (a))
+#undef x
+#define x 2
+#define g f
+#define z z[0]
+#define h g(~
+#define m(a) a(w)
+#define w 0,1
+#define t(a) a
+f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);
+g(x+(3,4)-w) | h 5) & m
+(f)^m(m);
+
+#define AA BB
+#define BB AA
+AA BB;
+#define LOOP(n) LOOP(n + 1)
+LOOP(LOOP(0));
+#define NIL(xxx) xxx
+#define G_0(arg) NIL(G_1)(arg)
+#define G_1(arg) NIL(arg)
+G_0(42)
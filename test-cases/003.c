@@ -0,0 +1,26 @@
+/* Object-like macros expanded with an empty hide-set are replayed from
+   a cached expansion. The cache must not outlive a #define or #undef,
+   must not cover expansions that read past their own tokens, and must
+   not replay __LINE__ */
+#define ONE 1
+#define TWO (ONE + ONE)
+#define FOUR (TWO * TWO)
+int a = FOUR + FOUR + FOUR;
+#undef ONE
+#define ONE 10
+int b = FOUR;
+#undef TWO
+int c = FOUR;
+#define TWO 2
+#define CALL ADD
+#define ADD(p, q) ((p) + (q))
+int d = CALL(1, 2) + CALL(3, 4);
+int e = CALL;
+#define HERE __LINE__
+int f = HERE;
+int g = HERE;
+#define EMPTY
+int EMPTY h EMPTY = EMPTY 5;
+#define PAREN (
+int i = ADD PAREN 1, 2);
+int j = FOUR;
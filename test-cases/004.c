@@ -0,0 +1,18 @@
+/* Include guards and #pragma once: a guarded file is skipped while its
+   guard is defined and read again once it is not, a file whose #ifndef
+   has an #else is not a guarded file, and an unguarded file is read
+   every time */
+#include "guarded.h"
+#include "guarded.h"
+#include "once.h"
+#include "once.h"
+#include "unguarded.h"
+#include "unguarded.h"
+#include "guard_else.h"
+#include "guard_else.h"
+#undef GUARDED_H
+#include "guarded.h"
+#include "guarded.h"
+#if defined(GUARDED_H) && !defined(NOT_DEFINED)
+int done;
+#endif
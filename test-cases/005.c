@@ -0,0 +1,75 @@
+/*Function bodies are parsed in parallel with -jN, in runs split by token
+  count. The tree must come out the same as a sequential parse*/
+typedef int count;
+typedef char *string;
+
+count length(string s) {
+    count n = 0;
+    while(*s++) ++n;
+    return n;
+}
+
+int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+/*count is an ordinary identifier inside this body only*/
+int shadow(int x) {
+    int count = x * 2;
+    return count;
+}
+
+typedef unsigned long size;
+
+size total(size * items, size n) {
+    size sum = 0;
+    size i;
+    for(i = 0; i < n; ++i) sum += items[i];
+    return sum;
+}
+
+int classify(int c) {
+    switch(c) {
+    case 0:
+        return 0;
+    case 1:
+    case 2:
+        c = c << 1;
+        break;
+    default:
+        c = -c;
+    }
+    return c;
+}
+
+/*count is a type again out here*/
+count twice(count c) {
+    return c + c;
+}
+
+int prototype(int a, long b);
+
+double scale(double d, float f) {
+    do {
+        d = d * f;
+    } while(d < 1.0);
+    return d;
+}
+
+int labels(int n) {
+    int r = 0;
+again:
+    if(n > 0) {
+        r += n--;
+        goto again;
+    }
+    return r;
+}
+
+unsigned char low(unsigned int v) {
+    return (unsigned char)(v & 0xff);
+}
+
+int main(void) {
+    return length("abc") + max(1, 2) + shadow(3) + classify(4) + twice(5) + labels(6);
+}
@@ -0,0 +1,5 @@
+/* Unterminated comment: a comment still open at the end of the file is
+   an error, and what follows it is not lexed as code */
+int x; /* closed */ int * p;
+/* never closed
+int y;
@@ -0,0 +1,9 @@
+/* One file reached through different paths: #pragma once and the
+   include guard see a single file, however its name is spelled */
+#include "include/once.h"
+#include "./include/once.h"
+#include "include/../include/once.h"
+#include <once.h>
+#include "include/guarded.h"
+#include ".//include/guarded.h"
+#include <guarded.h>
@@ -0,0 +1,14 @@
+/* Line splicing: a backslash-newline is removed before lexing, so a
+   directive goes on over several lines and a token can be cut by one.
+   Diagnostics keep the line numbers of the file as written */
+#define SUM(a, \
+            b) ((a) + \
+                (b))
+#define ONE 1 \
++ 0
+int total = SUM(ONE, 2);
+unsigned lo\
+ng_name = 0x\
+ff;
+char * s = "two \
+lines"; @
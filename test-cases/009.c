@@ -0,0 +1,21 @@
+typedef int T, *PT;
+static int s = 1;
+extern int e;
+int i, j = 2, *k;
+int f(int);
+int g(int, char *);
+int x, h(void);
+extern int f(int n);
+static int add(int a, int b) {
+    register int r = a;
+    static int count;
+    extern int e;
+    int u, v = 3;
+    T t;
+    PT pt;
+    u = r + b + count + e + v;
+    t = u;
+    pt = &t;
+    return *pt + f(u) + g(1, 0) + s + i + j + *k;
+}
+int f(int n) { return n; }
@@ -0,0 +1,41 @@
+int two(int a, int b);
+int conflict;
+char conflict;
+int defined = 1;
+int defined = 2;
+int twice(void) { return 0; }
+int twice(void) { return 1; }
+int * bad_init = 1.5;
+char * text;
+
+int bad_return(void) {
+    return text;
+}
+
+int checks(int n, int * p) {
+    int local;
+    local = missing;
+    local = two(n);
+    local = two(n, text);
+    local = text + p;
+    local = p * n;
+    3 = n;
+    n + 1 = 2;
+    two = 0;
+    *p = n;
+    p[0] = n;
+    return local;
+}
+
+int folds(int a, int x) {
+    int product = 4 * 8;
+    int same = a + 0;
+    unsigned long sizes = sizeof(int) + sizeof x;
+    switch(a) {
+    case 1 ? 2 : 1/0: return product;
+    case 0 && 1/0: return same;
+    case 1/0: return 1;
+    case x: return 2;
+    }
+    return sizes;
+}
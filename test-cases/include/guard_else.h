@@ -0,0 +1,6 @@
+#ifndef GUARD_ELSE_H
+#define GUARD_ELSE_H
+int guard_first;
+#else
+int guard_again;
+#endif
@@ -0,0 +1,13 @@
+/* Parallel lexing: make test repeats this file until it is cut into
+   several chunks, once as it is and once with a comment left open in the
+   middle, and checks that -j4 lexes it exactly as -j1 does. Comments
+   span lines so that some cuts fall inside one */
+int table[] = { 1, 0x10, 077, 4000000000, 99999999999999999999 };
+/*
+ * a comment over several lines, a cut here starts a chunk inside it
+ * int not_code = 1;
+ */
+char * s = "a /* not a comment */ string";
+int f(int a) { return a @ 2; } /* one line */ /* then another
+   that ends later */ int after;
+/**/ long g; /*** stars ***/ unsigned h;